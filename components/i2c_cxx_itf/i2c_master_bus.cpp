@@ -1,5 +1,16 @@
 #include "i2c_master_bus.hpp"
-#include <sstream>
+#include <cstdlib>
+
+void I2CMaster::driver_error(const esp_err_t err_code)
+{
+    // throw I2CDriverException(esp_err_to_name(err_code)); // doesn't work (char* problems)
+    ESP_ERROR_CHECK_WITHOUT_ABORT(err_code);  // to have the error message
+#if __cpp_exceptions
+    throw I2CDriverException();
+#else
+    abort();
+#endif
+}
 
 I2CMaster::I2CBus::I2CBus(
     i2c_port_t i2c_port,
@@ -7,13 +18,15 @@ I2CMaster::I2CBus::I2CBus(
     gpio_num_t scl_io_num,
     bool enable_internal_pullup,
     i2c_clock_source_t clk_source,
-    uint8_t glitch_ignore_cnt)
+    uint8_t glitch_ignore_cnt,
+    std::size_t trans_queue_depth)
     :m_i2c_master_config{
         .i2c_port = i2c_port,
         .sda_io_num = sda_io_num,
         .scl_io_num = scl_io_num,
         .clk_source = clk_source,
         .glitch_ignore_cnt = glitch_ignore_cnt,
+        .trans_queue_depth = trans_queue_depth,
         .flags{
             .enable_internal_pullup = enable_internal_pullup,
             }
@@ -24,9 +37,7 @@ I2CMaster::I2CBus::I2CBus(
     //ESP_ERROR_CHECK(i2c_new_master_bus(&m_i2c_master_config, &m_bus_handle));
     esp_err_t err_code = i2c_new_master_bus(&m_i2c_master_config, &m_bus_handle);
     if(err_code != ESP_OK){
-        // throw I2CDriverException(esp_err_to_name(err_code)); // doesn't work (char* problems)
-        ESP_ERROR_CHECK_WITHOUT_ABORT(err_code);  // to have the error message
-        throw I2CDriverException();
+        driver_error(err_code);
     }
 }
 
@@ -34,3 +45,12 @@ I2CMaster::I2CBus::~I2CBus(){
     // TODO verifier si tous les devices ont été supprimés au préalable ?
     ESP_ERROR_CHECK_WITHOUT_ABORT(i2c_del_master_bus(m_bus_handle));
 }
+
+auto I2CMaster::I2CBus::wait_all_done(const int timeout_ms) -> I2CResult<void>
+{
+    esp_err_t err_code = i2c_master_bus_wait_all_done(m_bus_handle, timeout_ms);
+    if (err_code != ESP_OK){
+        return std::unexpected(err_code);
+    }
+    return {};
+}
@@ -13,16 +13,28 @@ I2CMaster::I2CDevice::I2CDevice(
         .dev_addr_length = dev_addr_length,
         .device_address = device_address,
         .scl_speed_hz = scl_speed_hz,
-    }
+    },
+    m_done_callback{nullptr},
+    m_done_callback_arg{nullptr},
+    m_async_pending{0},
+    m_trans_failed{false},
+    m_blocking_failed{false}
 {
     esp_err_t err_code = i2c_master_bus_add_device(
         m_master_bus.m_bus_handle,
         &m_i2c_device_config,
         &m_device_handle);
     if(err_code != ESP_OK){
-        // throw I2CDriverException(esp_err_to_name(err_code)); // doesn't work (char* problems)
-        ESP_ERROR_CHECK_WITHOUT_ABORT(err_code);  // to have the error message
-        throw I2CDriverException();
+        driver_error(err_code);
+    }
+    if (m_master_bus.is_async()){
+        const i2c_master_event_callbacks_t callbacks = {
+            .on_trans_done = on_trans_done,
+        };
+        err_code = i2c_master_register_event_callbacks(m_device_handle, &callbacks, static_cast<void*>(this));
+        if(err_code != ESP_OK){
+            driver_error(err_code);
+        }
     }
 }
 
@@ -30,23 +42,26 @@ I2CMaster::I2CDevice::~I2CDevice(){
     ESP_ERROR_CHECK_WITHOUT_ABORT(i2c_master_bus_rm_device(m_device_handle));
 }
 
+#if __cpp_exceptions
+static void check_error(const I2CMaster::I2CResult<void>& result)
+{
+    if (result){
+        return;
+    }
+    const esp_err_t err_code = result.error();
+    if (I2CMaster::is_bus_error(err_code)){
+        throw I2CMaster::I2CBusErrorException();
+    }
+    // throw I2CDriverException(esp_err_to_name(err_code)); // doesn't work (char* problems)
+    ESP_ERROR_CHECK_WITHOUT_ABORT(err_code);  // to have the error message
+    throw I2CMaster::I2CDriverException();
+}
+
 auto I2CMaster::I2CDevice::transmit(
     const std::vector<uint8_t>& data,
     const int timeout_ms) -> void
 {
-    esp_err_t err_code = i2c_master_transmit(
-        m_device_handle,
-        data.data(),
-        data.size(),
-        timeout_ms);
-    if ((err_code == ESP_ERR_TIMEOUT) || (err_code == ESP_ERR_INVALID_STATE)){
-        throw I2CBusErrorException();
-    }
-    if(err_code != ESP_OK){
-        // throw I2CDriverException(esp_err_to_name(err_code)); // doesn't work (char* problems)
-        ESP_ERROR_CHECK_WITHOUT_ABORT(err_code);  // to have the error message
-        throw I2CDriverException();
-    }
+    transmit(std::span<const uint8_t>{data}, timeout_ms);
 }
 
 auto I2CMaster::I2CDevice::receive(
@@ -55,88 +70,178 @@ auto I2CMaster::I2CDevice::receive(
 {
     // initialisation d'un vector de taille nb_data_to_read
     std::vector<uint8_t> data_to_read(nb_data_to_read);
-
-    esp_err_t err_code = i2c_master_receive(
-        m_device_handle,
-        data_to_read.data(),
-        data_to_read.size(),
-        timeout_ms);
-    if ((err_code == ESP_ERR_TIMEOUT) || (err_code == ESP_ERR_INVALID_STATE)){
-        throw I2CBusErrorException();
-    }
-    if(err_code != ESP_OK){
-        // throw I2CDriverException(esp_err_to_name(err_code)); // doesn't work (char* problems)
-        ESP_ERROR_CHECK_WITHOUT_ABORT(err_code);  // to have the error message
-        throw I2CDriverException();
-    }
-
+    receive_in(std::span<uint8_t>{data_to_read}, timeout_ms);
     return data_to_read;
 }
 
 auto I2CMaster::I2CDevice::receive_in(
     std::vector<uint8_t>& data_to_read,
     const int timeout_ms) -> void
-    {
-    esp_err_t err_code = i2c_master_receive(
-        m_device_handle,
-        data_to_read.data(),
-        data_to_read.size(),
-        timeout_ms);
-    if ((err_code == ESP_ERR_TIMEOUT) || (err_code == ESP_ERR_INVALID_STATE)){
-        throw I2CBusErrorException();
-    }
-    if(err_code != ESP_OK){
-        // throw I2CDriverException(esp_err_to_name(err_code)); // doesn't work (char* problems)
-        ESP_ERROR_CHECK_WITHOUT_ABORT(err_code);  // to have the error message
-        throw I2CDriverException();
-    }
+{
+    receive_in(std::span<uint8_t>{data_to_read}, timeout_ms);
 }
 
 auto I2CMaster::I2CDevice::transmit_receive(
     const std::vector<uint8_t>& data_to_write,
     const std::size_t nb_data_to_read,
     const int timeout_ms) -> std::vector<uint8_t>
-    {
+{
     // initialisation d'un vector de taille nb_data_to_read
     std::vector<uint8_t> data_to_read(nb_data_to_read);
+    transmit_receive_in(std::span<const uint8_t>{data_to_write}, std::span<uint8_t>{data_to_read}, timeout_ms);
+    return data_to_read;
+}
+
+auto I2CMaster::I2CDevice::transmit_receive_in(
+    const std::vector<uint8_t>& data_to_write,
+    std::vector<uint8_t>& data_to_read,
+    const int timeout_ms) -> void
+{
+    transmit_receive_in(std::span<const uint8_t>{data_to_write}, std::span<uint8_t>{data_to_read}, timeout_ms);
+}
+
+// allocation-free variants
+auto I2CMaster::I2CDevice::transmit(
+    std::span<const uint8_t> data,
+    const int timeout_ms) -> void
+{
+    check_error(try_transmit(data, timeout_ms));
+}
+
+auto I2CMaster::I2CDevice::receive_in(
+    std::span<uint8_t> data_to_read,
+    const int timeout_ms) -> void
+{
+    check_error(try_receive_in(data_to_read, timeout_ms));
+}
 
-    esp_err_t err_code = i2c_master_transmit_receive(
+auto I2CMaster::I2CDevice::transmit_receive_in(
+    std::span<const uint8_t> data_to_write,
+    std::span<uint8_t> data_to_read,
+    const int timeout_ms) -> void
+{
+    check_error(try_transmit_receive_in(data_to_write, data_to_read, timeout_ms));
+}
+#endif // __cpp_exceptions
+
+// exception-free API
+static auto to_result(const esp_err_t err_code) -> I2CMaster::I2CResult<void>
+{
+    if (err_code != ESP_OK){
+        return std::unexpected(err_code);
+    }
+    return {};
+}
+
+auto I2CMaster::I2CDevice::try_transmit(
+    std::span<const uint8_t> data,
+    const int timeout_ms) -> I2CResult<void>
+{
+    m_blocking_failed.store(false, std::memory_order_relaxed);
+    return wait_if_async(i2c_master_transmit(
+        m_device_handle,
+        data.data(),
+        data.size(),
+        timeout_ms), timeout_ms);
+}
+
+auto I2CMaster::I2CDevice::try_receive_in(
+    std::span<uint8_t> data_to_read,
+    const int timeout_ms) -> I2CResult<void>
+{
+    m_blocking_failed.store(false, std::memory_order_relaxed);
+    return wait_if_async(i2c_master_receive(
+        m_device_handle,
+        data_to_read.data(),
+        data_to_read.size(),
+        timeout_ms), timeout_ms);
+}
+
+auto I2CMaster::I2CDevice::try_transmit_receive_in(
+    std::span<const uint8_t> data_to_write,
+    std::span<uint8_t> data_to_read,
+    const int timeout_ms) -> I2CResult<void>
+{
+    m_blocking_failed.store(false, std::memory_order_relaxed);
+    return wait_if_async(i2c_master_transmit_receive(
         m_device_handle,
         data_to_write.data(),
         data_to_write.size(),
         data_to_read.data(),
         data_to_read.size(),
-        timeout_ms);
-    if ((err_code == ESP_ERR_TIMEOUT) || (err_code == ESP_ERR_INVALID_STATE)){
-        throw I2CBusErrorException();
+        timeout_ms), timeout_ms);
+}
+
+// asynchronous API
+bool I2CMaster::I2CDevice::on_trans_done(i2c_master_dev_handle_t i2c_dev, const i2c_master_event_data_t* evt_data, void* arg)
+{
+    // I2C ISR context. Transactions of a device are done in the order they were queued :
+    // the first m_async_pending ones are the asynchronous ones
+    I2CDevice* device = static_cast<I2CDevice*>(arg);
+    const bool success = (evt_data->event == I2C_EVENT_DONE);
+    if (device->m_async_pending.load(std::memory_order_relaxed) == 0){
+        // blocking transaction : status for wait_if_async only, no done callback
+        if (!success){
+            device->m_blocking_failed.store(true, std::memory_order_relaxed);
+        }
+        return false;
     }
-    if(err_code != ESP_OK){
-        // throw I2CDriverException(esp_err_to_name(err_code)); // doesn't work (char* problems)
-        ESP_ERROR_CHECK_WITHOUT_ABORT(err_code);  // to have the error message
-        throw I2CDriverException();
+    device->m_async_pending.fetch_sub(1, std::memory_order_relaxed);
+    if (!success){
+        device->m_trans_failed.store(true, std::memory_order_relaxed);
+    }
+    if (device->m_done_callback != nullptr){
+        return device->m_done_callback(success, device->m_done_callback_arg);
     }
+    return false;
+}
 
-    return data_to_read;
+// blocking API on an asynchronous bus : wait for the queued transaction to keep the
+// caller's buffers valid, then report its completion status
+auto I2CMaster::I2CDevice::wait_if_async(const esp_err_t err_code, const int timeout_ms) -> I2CResult<void>
+{
+    if ((err_code != ESP_OK) || (!m_master_bus.is_async())){
+        return to_result(err_code);
+    }
+    const auto result = m_master_bus.wait_all_done(timeout_ms);
+    if (!result){
+        return result;
+    }
+    if (m_blocking_failed.exchange(false, std::memory_order_relaxed)){
+        return std::unexpected(ESP_ERR_INVALID_STATE); // NACK : same as a synchronous bus error
+    }
+    return {};
 }
 
-auto I2CMaster::I2CDevice::transmit_receive_in(
-    const std::vector<uint8_t>& data_to_write,
-    std::vector<uint8_t>& data_to_read,
-    const int timeout_ms) -> void
-    {
-    esp_err_t err_code = i2c_master_transmit_receive(
+void I2CMaster::I2CDevice::set_done_callback(TransDoneCallback callback, void* arg)
+{
+    m_done_callback_arg = arg;
+    m_done_callback = callback;
+}
+
+auto I2CMaster::I2CDevice::transmit_receive_async(
+    std::span<const uint8_t> data_to_write,
+    std::span<uint8_t> data_to_read) -> I2CResult<void>
+{
+    if (!m_master_bus.is_async()){
+        return std::unexpected(ESP_ERR_NOT_SUPPORTED);
+    }
+    // counted before queueing : the done callback may come first
+    m_async_pending.fetch_add(1, std::memory_order_relaxed);
+    const esp_err_t err_code = i2c_master_transmit_receive(
         m_device_handle,
         data_to_write.data(),
         data_to_write.size(),
         data_to_read.data(),
         data_to_read.size(),
-        timeout_ms);
-    if ((err_code == ESP_ERR_TIMEOUT) || (err_code == ESP_ERR_INVALID_STATE)){
-        throw I2CBusErrorException();
-    }
-    if(err_code != ESP_OK){
-        // throw I2CDriverException(esp_err_to_name(err_code)); // doesn't work (char* problems)
-        ESP_ERROR_CHECK_WITHOUT_ABORT(err_code);  // to have the error message
-        throw I2CDriverException();
+        -1);
+    if (err_code != ESP_OK){
+        m_async_pending.fetch_sub(1, std::memory_order_relaxed);
     }
+    return to_result(err_code);
+}
+
+auto I2CMaster::I2CDevice::async_failed(void) -> bool
+{
+    return m_trans_failed.exchange(false, std::memory_order_relaxed);
 }
@@ -1,5 +1,6 @@
 #pragma once
 #include <exception>
+#include <expected>
 extern "C" {
 #include "driver/i2c_types.h"
 #include "driver/i2c_master.h"
@@ -26,6 +27,18 @@ namespace I2CMaster{
         }
     };
 
+    // Exception-free results (usable with -fno-exceptions) : value or esp_err_t code
+    template<typename T>
+    using I2CResult = std::expected<T, esp_err_t>;
+
+    // bus errors (device disconnected, no ACK...) as opposed to driver/usage errors
+    inline bool is_bus_error(const esp_err_t err_code){
+        return (err_code == ESP_ERR_TIMEOUT) || (err_code == ESP_ERR_INVALID_STATE);
+    }
+
+    // Driver error at construction : exception if enabled, abort otherwise
+    void driver_error(const esp_err_t err_code);
+
     class I2CBus{
         i2c_master_bus_config_t m_i2c_master_config; // TODO utile à conserve comme membre ? ou jetable ?
         i2c_master_bus_handle_t m_bus_handle;
@@ -36,13 +49,18 @@ namespace I2CMaster{
             gpio_num_t scl_io_num,
             bool enable_internal_pullup,
             i2c_clock_source_t clk_source = I2C_CLK_SRC_DEFAULT,
-            uint8_t glitch_ignore_cnt = 7);
+            uint8_t glitch_ignore_cnt = 7,
+            std::size_t trans_queue_depth = 0); // > 0 : asynchronous (queued) transactions
 
         I2CBus(const I2CBus&) = delete;
         I2CBus& operator=(const I2CBus&) = delete;
 
         ~I2CBus();
 
+        // asynchronous mode : transactions are queued and completed by the I2C ISR
+        auto is_async(void) const -> bool {return m_i2c_master_config.trans_queue_depth > 0;}
+        auto wait_all_done(const int timeout_ms=-1) -> I2CResult<void>;
+
         friend class I2CDevice;
     };
 
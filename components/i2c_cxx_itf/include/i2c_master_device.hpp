@@ -1,14 +1,29 @@
 #pragma once
 #include <vector>
+#include <span>
+#include <atomic>
 #include "driver/i2c_master.h"
 #include "i2c_master_bus.hpp"
 
 namespace I2CMaster{
 
+    // Asynchronous transaction done callback, called from the I2C ISR (keep it short).
+    // Returns true if a higher priority task has been woken up.
+    using TransDoneCallback = bool (*)(bool success, void* arg);
+
     class I2CDevice{
         I2CBus& m_master_bus; // TODO utile à conserve comme membre ? ou jetable ?
         i2c_device_config_t m_i2c_device_config; // TODO utile à conserve comme membre ? ou jetable ?
         i2c_master_dev_handle_t m_device_handle;
+        // asynchronous mode
+        TransDoneCallback m_done_callback;
+        void* m_done_callback_arg;
+        std::atomic<uint32_t> m_async_pending;  // queued by transmit_receive_async, not done yet
+        std::atomic<bool> m_trans_failed;       // asynchronous transactions
+        std::atomic<bool> m_blocking_failed;    // blocking transaction of wait_if_async
+
+        static bool on_trans_done(i2c_master_dev_handle_t i2c_dev, const i2c_master_event_data_t* evt_data, void* arg);
+        auto wait_if_async(const esp_err_t err_code, const int timeout_ms) -> I2CResult<void>;
     public:
         I2CDevice(
             I2CBus& master_bus,
@@ -21,12 +36,30 @@ namespace I2CMaster{
 
         ~I2CDevice();
 
+#if __cpp_exceptions
+        // throwing API (I2CBusErrorException / I2CDriverException)
         auto transmit(const std::vector<uint8_t>& data, const int timeout_ms=-1) -> void;
         auto receive(const std::size_t nb_data_to_read, const int timeout_ms=-1) -> std::vector<uint8_t>;
         auto receive_in(std::vector<uint8_t>& data_to_read, const int timeout_ms=-1) -> void;
         auto transmit_receive(const std::vector<uint8_t>& data_to_write, const std::size_t nb_data_to_read, const int timeout_ms=-1) -> std::vector<uint8_t>;
         auto transmit_receive_in(const std::vector<uint8_t>& data_to_write, std::vector<uint8_t>& data_to_read, const int timeout_ms=-1) -> void;
 
+        // allocation-free variants (caller owns the buffers, e.g. std::array)
+        auto transmit(std::span<const uint8_t> data, const int timeout_ms=-1) -> void;
+        auto receive_in(std::span<uint8_t> data_to_read, const int timeout_ms=-1) -> void;
+        auto transmit_receive_in(std::span<const uint8_t> data_to_write, std::span<uint8_t> data_to_read, const int timeout_ms=-1) -> void;
+#endif
+
+        // exception-free API : error code returned, bounded time error path
+        auto try_transmit(std::span<const uint8_t> data, const int timeout_ms=-1) -> I2CResult<void>;
+        auto try_receive_in(std::span<uint8_t> data_to_read, const int timeout_ms=-1) -> I2CResult<void>;
+        auto try_transmit_receive_in(std::span<const uint8_t> data_to_write, std::span<uint8_t> data_to_read, const int timeout_ms=-1) -> I2CResult<void>;
+
+        // asynchronous API (bus created with trans_queue_depth > 0) : returns once queued,
+        // buffers must stay valid until the done callback
+        void set_done_callback(TransDoneCallback callback, void* arg);
+        auto transmit_receive_async(std::span<const uint8_t> data_to_write, std::span<uint8_t> data_to_read) -> I2CResult<void>;
+        auto async_failed(void) -> bool; // a queued transaction failed since last call
     };
 
 } // namespace
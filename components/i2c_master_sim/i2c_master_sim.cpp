@@ -0,0 +1,240 @@
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <new>
+
+#include "esp_log.h"
+#include "i2c_master_sim.hpp"
+
+#define TAG "I2CSim"
+
+struct i2c_master_bus_t{
+    i2c_master_bus_config_t config;
+};
+
+struct i2c_master_dev_t{
+    i2c_master_bus_t *bus;
+    i2c_device_config_t config;
+    i2c_master_callback_t on_trans_done;
+    void *user_data;
+};
+
+namespace {
+
+    struct Target_t
+    {
+        I2CSim::SimDevice *device;
+        uint32_t nacks_pending;
+    };
+
+    struct Bus_t
+    {
+        bool installed;
+        std::map<uint16_t, Target_t> targets;
+        I2CSim::BusStats_t stats;
+    };
+
+    std::mutex sim_mutex;
+    Bus_t sim_buses[I2C_NUM_MAX];
+    uint32_t sim_transaction_us = 0;
+    bool sim_scl_timing = false;
+
+    bool valid_port(const i2c_port_num_t port)
+    {
+        return (port >= 0) && (port < I2C_NUM_MAX);
+    }
+
+    void busy_wait_us(const uint64_t duration_us)
+    {
+        const auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(duration_us);
+        while (std::chrono::steady_clock::now() < end){}
+    }
+
+    // one transaction : optional write phase, optional read phase (repeated start)
+    esp_err_t transaction(i2c_master_dev_t *dev, const uint8_t *write_buffer, size_t write_size, uint8_t *read_buffer, size_t read_size)
+    {
+        if ((dev == NULL) || ((write_buffer == NULL) && (write_size > 0)) || ((read_buffer == NULL) && (read_size > 0))){
+            return ESP_ERR_INVALID_ARG;
+        }
+        bool ack = false;
+        uint64_t duration_us = sim_transaction_us;
+        {
+            std::lock_guard<std::mutex> lock(sim_mutex);
+            Bus_t& bus = sim_buses[dev->bus->config.i2c_port];
+            const auto target = bus.targets.find(dev->config.device_address);
+            if ((target != bus.targets.end()) && (target->second.nacks_pending > 0)){
+                target->second.nacks_pending--;
+            } else if (target != bus.targets.end()){
+                ack = ((write_size == 0) || target->second.device->on_write({write_buffer, write_size}))
+                    && ((read_size == 0) || target->second.device->on_read({read_buffer, read_size}));
+            }
+            if (sim_scl_timing && (dev->config.scl_speed_hz > 0)){
+                const uint64_t nb_bytes = write_size + read_size + ((write_size > 0) ? 1 : 0) + ((read_size > 0) ? 1 : 0);
+                duration_us += (nb_bytes * 9 * 1000000ULL) / dev->config.scl_speed_hz;
+            }
+            bus.stats.nb_transactions++;
+            bus.stats.nb_nacks += ack ? 0 : 1;
+            bus.stats.nb_bytes += write_size + read_size;
+            bus.stats.busy_us += duration_us;
+        }
+        busy_wait_us(duration_us);
+
+        if (dev->bus->config.trans_queue_depth > 0){
+            // asynchronous bus : queued then done, the error is only reported to the callback
+            if (dev->on_trans_done != NULL){
+                const i2c_master_event_data_t evt_data = {
+                    .event = ack ? I2C_EVENT_DONE : I2C_EVENT_NACK,
+                };
+                dev->on_trans_done(dev, &evt_data, dev->user_data);
+            }
+            return ESP_OK;
+        }
+        // NACK reported as the 5.3 driver does
+        return ack ? ESP_OK : ESP_ERR_INVALID_STATE;
+    }
+
+} // namespace
+
+// simulation control
+void I2CSim::attach(i2c_port_num_t port, uint16_t address, SimDevice& device)
+{
+    if (!valid_port(port)){
+        return;
+    }
+    std::lock_guard<std::mutex> lock(sim_mutex);
+    sim_buses[port].targets[address] = Target_t{&device, 0};
+}
+
+void I2CSim::detach(i2c_port_num_t port, uint16_t address)
+{
+    if (!valid_port(port)){
+        return;
+    }
+    std::lock_guard<std::mutex> lock(sim_mutex);
+    sim_buses[port].targets.erase(address);
+}
+
+void I2CSim::set_latency(uint32_t transaction_us, bool scl_timing)
+{
+    std::lock_guard<std::mutex> lock(sim_mutex);
+    sim_transaction_us = transaction_us;
+    sim_scl_timing = scl_timing;
+}
+
+void I2CSim::inject_nack(i2c_port_num_t port, uint16_t address, uint32_t nb_transactions)
+{
+    if (!valid_port(port)){
+        return;
+    }
+    std::lock_guard<std::mutex> lock(sim_mutex);
+    const auto target = sim_buses[port].targets.find(address);
+    if (target != sim_buses[port].targets.end()){
+        target->second.nacks_pending = nb_transactions;
+    }
+}
+
+auto I2CSim::stats(i2c_port_num_t port) -> BusStats_t
+{
+    if (!valid_port(port)){
+        return BusStats_t{};
+    }
+    std::lock_guard<std::mutex> lock(sim_mutex);
+    return sim_buses[port].stats;
+}
+
+void I2CSim::reset_stats(i2c_port_num_t port)
+{
+    if (!valid_port(port)){
+        return;
+    }
+    std::lock_guard<std::mutex> lock(sim_mutex);
+    sim_buses[port].stats = BusStats_t{};
+}
+
+// driver/i2c_master.h API
+esp_err_t i2c_new_master_bus(const i2c_master_bus_config_t *bus_config, i2c_master_bus_handle_t *ret_bus_handle)
+{
+    if ((bus_config == NULL) || (ret_bus_handle == NULL) || !valid_port(bus_config->i2c_port)){
+        return ESP_ERR_INVALID_ARG;
+    }
+    std::lock_guard<std::mutex> lock(sim_mutex);
+    if (sim_buses[bus_config->i2c_port].installed){
+        ESP_LOGE(TAG, "I2C bus %d already installed", bus_config->i2c_port);
+        return ESP_ERR_INVALID_STATE;
+    }
+    i2c_master_bus_t *bus = new (std::nothrow) i2c_master_bus_t{*bus_config};
+    if (bus == NULL){
+        return ESP_ERR_NO_MEM;
+    }
+    sim_buses[bus_config->i2c_port].installed = true;
+    *ret_bus_handle = bus;
+    return ESP_OK;
+}
+
+esp_err_t i2c_del_master_bus(i2c_master_bus_handle_t bus_handle)
+{
+    if (bus_handle == NULL){
+        return ESP_ERR_INVALID_ARG;
+    }
+    std::lock_guard<std::mutex> lock(sim_mutex);
+    sim_buses[bus_handle->config.i2c_port].installed = false;
+    delete bus_handle;
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_bus_add_device(i2c_master_bus_handle_t bus_handle, const i2c_device_config_t *dev_config, i2c_master_dev_handle_t *ret_handle)
+{
+    if ((bus_handle == NULL) || (dev_config == NULL) || (ret_handle == NULL)){
+        return ESP_ERR_INVALID_ARG;
+    }
+    i2c_master_dev_t *dev = new (std::nothrow) i2c_master_dev_t{bus_handle, *dev_config, NULL, NULL};
+    if (dev == NULL){
+        return ESP_ERR_NO_MEM;
+    }
+    *ret_handle = dev;
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_bus_rm_device(i2c_master_dev_handle_t handle)
+{
+    if (handle == NULL){
+        return ESP_ERR_INVALID_ARG;
+    }
+    delete handle;
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_transmit(i2c_master_dev_handle_t i2c_dev, const uint8_t *write_buffer, size_t write_size, int xfer_timeout_ms)
+{
+    return transaction(i2c_dev, write_buffer, write_size, NULL, 0);
+}
+
+esp_err_t i2c_master_receive(i2c_master_dev_handle_t i2c_dev, uint8_t *read_buffer, size_t read_size, int xfer_timeout_ms)
+{
+    return transaction(i2c_dev, NULL, 0, read_buffer, read_size);
+}
+
+esp_err_t i2c_master_transmit_receive(i2c_master_dev_handle_t i2c_dev, const uint8_t *write_buffer, size_t write_size,
+    uint8_t *read_buffer, size_t read_size, int xfer_timeout_ms)
+{
+    return transaction(i2c_dev, write_buffer, write_size, read_buffer, read_size);
+}
+
+esp_err_t i2c_master_register_event_callbacks(i2c_master_dev_handle_t i2c_dev, const i2c_master_event_callbacks_t *cbs, void *user_data)
+{
+    if ((i2c_dev == NULL) || (cbs == NULL)){
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (i2c_dev->bus->config.trans_queue_depth == 0){
+        return ESP_ERR_INVALID_STATE;  // callbacks only in asynchronous mode
+    }
+    i2c_dev->on_trans_done = cbs->on_trans_done;
+    i2c_dev->user_data = user_data;
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_bus_wait_all_done(i2c_master_bus_handle_t bus_handle, int timeout_ms)
+{
+    // transactions are completed before returning : nothing in flight
+    return (bus_handle == NULL) ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
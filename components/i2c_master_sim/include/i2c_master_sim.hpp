@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <span>
+
+#include "driver/i2c_master.h"
+
+// Simulated I2C master driver (linux target) : the i2c_master_* functions are routed to
+// software models of the I2C targets, so that I2CMaster::I2CBus / I2CDevice and the
+// drivers built on them run unchanged on a build machine.
+// Asynchronous buses (trans_queue_depth > 0) complete each transaction before returning,
+// then call the done callback from the calling thread.
+namespace I2CSim{
+
+    // Simulated I2C target : returning false NACKs the transaction
+    class SimDevice{
+    public:
+        virtual ~SimDevice() = default;
+        // write phase (first byte usually a register address)
+        virtual bool on_write(std::span<const uint8_t> data) = 0;
+        // read phase (after a repeated start, or alone)
+        virtual bool on_read(std::span<uint8_t> data) = 0;
+    };
+
+    struct BusStats_t
+    {
+        uint32_t nb_transactions;
+        uint32_t nb_nacks;
+        uint64_t nb_bytes;      // data bytes (address bytes excluded)
+        uint64_t busy_us;       // simulated transactions duration
+    };
+
+    // target answering at address on the bus of the given port (not owned)
+    void attach(i2c_port_num_t port, uint16_t address, SimDevice& device);
+    void detach(i2c_port_num_t port, uint16_t address);
+
+    // simulated transaction duration (busy wait) : fixed time, plus the bytes on the wire
+    // at the device SCL speed (9 clocks per byte, address bytes included) if scl_timing
+    void set_latency(uint32_t transaction_us, bool scl_timing = false);
+    // the next nb_transactions to this address are NACKed (unplugged device, bus noise...)
+    void inject_nack(i2c_port_num_t port, uint16_t address, uint32_t nb_transactions);
+
+    auto stats(i2c_port_num_t port) -> BusStats_t;
+    void reset_stats(i2c_port_num_t port);
+
+} // namespace
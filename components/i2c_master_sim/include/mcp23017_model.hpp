@@ -0,0 +1,48 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <span>
+
+#include "i2c_master_sim.hpp"
+
+namespace I2CSim{
+
+    // MCP23017 register model (IOCON.BANK = 0 addressing) :
+    // IODIR, IPOL, GPPU, GPIO/OLAT, interrupt on change (GPINTEN, DEFVAL, INTCON, INTF, INTCAP),
+    // IOCON MIRROR / ODR / INTPOL / SEQOP. BANK = 1 addressing is not modelled.
+    class MCP23017Model : public SimDevice{
+    public:
+        static constexpr std::size_t NbRegisters = 0x16;
+
+        MCP23017Model();
+
+        // power-on reset register values
+        void reset(void);
+
+        // external pins levels, port A bits 0..7, port B bits 8..15.
+        // Pins not in driven read 1 if their pull-up is enabled, 0 otherwise
+        void set_pins(uint16_t levels, uint16_t driven = 0xFFFF);
+        auto reg(uint8_t address) -> uint8_t;
+        // INTA (port 0) / INTB (port 1) pin level, open-drain released pin read high
+        auto int_pin(uint8_t port) -> bool;
+
+        bool on_write(std::span<const uint8_t> data) override;
+        bool on_read(std::span<uint8_t> data) override;
+
+    private:
+        std::mutex m_mutex;
+        std::array<uint8_t, NbRegisters> m_regs;
+        uint16_t m_levels;
+        uint16_t m_driven;
+        uint8_t m_pointer;
+
+        auto gpio(std::size_t port) const -> uint8_t;
+        auto read_register(uint8_t address) -> uint8_t;
+        void write_register(uint8_t address, uint8_t value);
+        void next_register(void);
+        void update_interrupts(const std::array<uint8_t, 2>& gpio_prec);
+        void clear_interrupt(std::size_t port);
+    };
+
+} // namespace
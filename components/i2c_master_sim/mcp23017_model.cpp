@@ -0,0 +1,179 @@
+#include "mcp23017_model.hpp"
+
+// register addresses, IOCON.BANK = 0 (port A even, port B odd)
+#define REG_IODIR   0x00
+#define REG_IPOL    0x02
+#define REG_GPINTEN 0x04
+#define REG_DEFVAL  0x06
+#define REG_INTCON  0x08
+#define REG_IOCON   0x0A
+#define REG_GPPU    0x0C
+#define REG_INTF    0x0E
+#define REG_INTCAP  0x10
+#define REG_GPIO    0x12
+#define REG_OLAT    0x14
+
+// IOCON bits
+#define IOCON_BANK   0x80
+#define IOCON_MIRROR 0x40
+#define IOCON_SEQOP  0x20
+#define IOCON_ODR    0x04
+#define IOCON_INTPOL 0x02
+
+I2CSim::MCP23017Model::MCP23017Model()
+{
+    reset();
+}
+
+void I2CSim::MCP23017Model::reset(void)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_regs.fill(0x00);
+    m_regs[REG_IODIR] = 0xFF;  // all pins as inputs
+    m_regs[REG_IODIR + 1] = 0xFF;
+    m_levels = 0x0000;
+    m_driven = 0x0000;
+    m_pointer = 0;
+}
+
+// GPIO register value : inputs pins (polarity applied) and output latches
+auto I2CSim::MCP23017Model::gpio(std::size_t port) const -> uint8_t
+{
+    const uint8_t levels = m_levels >> (8 * port);
+    const uint8_t driven = m_driven >> (8 * port);
+    const uint8_t pins = (levels & driven) | (m_regs[REG_GPPU + port] & ~driven);
+    const uint8_t inputs = m_regs[REG_IODIR + port];
+    return ((pins ^ m_regs[REG_IPOL + port]) & inputs) | (m_regs[REG_OLAT + port] & ~inputs);
+}
+
+void I2CSim::MCP23017Model::set_pins(uint16_t levels, uint16_t driven)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const std::array<uint8_t, 2> gpio_prec{gpio(0), gpio(1)};
+    m_levels = levels;
+    m_driven = driven;
+    update_interrupts(gpio_prec);
+}
+
+// interrupt on change : from the previous pin value (INTCON = 0) or from DEFVAL (INTCON = 1).
+// INTF / INTCAP are latched by the first interrupt, until it is cleared.
+void I2CSim::MCP23017Model::update_interrupts(const std::array<uint8_t, 2>& gpio_prec)
+{
+    for (std::size_t p = 0; p < 2; p++){
+        const uint8_t value = gpio(p);
+        const uint8_t intcon = m_regs[REG_INTCON + p];
+        const uint8_t mismatch = ((value ^ gpio_prec[p]) & ~intcon) | ((value ^ m_regs[REG_DEFVAL + p]) & intcon);
+        const uint8_t flags = mismatch & m_regs[REG_GPINTEN + p] & m_regs[REG_IODIR + p];
+        if (flags && (m_regs[REG_INTF + p] == 0)){
+            m_regs[REG_INTF + p] = flags;
+            m_regs[REG_INTCAP + p] = value;
+        }
+    }
+}
+
+// INTCAP or GPIO read : interrupt cleared (raised again at once if a DEFVAL mismatch remains)
+void I2CSim::MCP23017Model::clear_interrupt(std::size_t port)
+{
+    m_regs[REG_INTF + port] = 0;
+    const uint8_t value = gpio(port);
+    update_interrupts(port == 0 ? std::array<uint8_t, 2>{value, gpio(1)} : std::array<uint8_t, 2>{gpio(0), value});
+}
+
+auto I2CSim::MCP23017Model::read_register(uint8_t address) -> uint8_t
+{
+    const std::size_t port = address & 0x01;
+    switch (address & ~0x01){
+    case REG_GPIO: {
+        const uint8_t value = gpio(port);
+        clear_interrupt(port);
+        return value;
+    }
+    case REG_INTCAP: {
+        const uint8_t value = m_regs[address];
+        clear_interrupt(port);
+        return value;
+    }
+    default:
+        return m_regs[address];
+    }
+}
+
+void I2CSim::MCP23017Model::write_register(uint8_t address, uint8_t value)
+{
+    const std::size_t port = address & 0x01;
+    const std::array<uint8_t, 2> gpio_prec{gpio(0), gpio(1)};
+    switch (address & ~0x01){
+    case REG_IOCON:
+        // one IOCON register at both addresses, BANK = 1 addressing not modelled
+        m_regs[REG_IOCON] = value & ~IOCON_BANK;
+        m_regs[REG_IOCON + 1] = value & ~IOCON_BANK;
+        break;
+    case REG_INTF:
+    case REG_INTCAP:
+        break;  // read-only
+    case REG_GPIO:
+        m_regs[REG_OLAT + port] = value;
+        break;
+    default:
+        m_regs[address] = value;
+        break;
+    }
+    // configuration changes may raise an interrupt (DEFVAL comparison)
+    update_interrupts(gpio_prec);
+}
+
+// sequential operation : whole register map, byte mode (SEQOP) : toggles within the pair
+void I2CSim::MCP23017Model::next_register(void)
+{
+    if (m_regs[REG_IOCON] & IOCON_SEQOP){
+        m_pointer ^= 0x01;
+    } else {
+        m_pointer = (m_pointer + 1) % NbRegisters;
+    }
+}
+
+bool I2CSim::MCP23017Model::on_write(std::span<const uint8_t> data)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (data.empty()){
+        return true;  // address only
+    }
+    if (data[0] >= NbRegisters){
+        return false;
+    }
+    m_pointer = data[0];
+    for (const uint8_t value : data.subspan(1)){
+        write_register(m_pointer, value);
+        next_register();
+    }
+    return true;
+}
+
+bool I2CSim::MCP23017Model::on_read(std::span<uint8_t> data)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (uint8_t& value : data){
+        value = read_register(m_pointer);
+        next_register();
+    }
+    return true;
+}
+
+auto I2CSim::MCP23017Model::reg(uint8_t address) -> uint8_t
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return (address < NbRegisters) ? m_regs[address] : 0;
+}
+
+auto I2CSim::MCP23017Model::int_pin(uint8_t port) -> bool
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const uint8_t iocon = m_regs[REG_IOCON];
+    const bool active = (iocon & IOCON_MIRROR)
+        ? ((m_regs[REG_INTF] | m_regs[REG_INTF + 1]) != 0)
+        : (m_regs[REG_INTF + (port & 0x01)] != 0);
+    if (iocon & IOCON_ODR){
+        return !active;  // open-drain, active low
+    }
+    return active == static_cast<bool>(iocon & IOCON_INTPOL);
+}
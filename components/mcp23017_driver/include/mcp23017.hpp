@@ -1,5 +1,7 @@
 #pragma once
-#include <map>
+#include <array>
+#include <vector>
+#include <span>
 #include <utility>
 
 #include "i2c_master_bus.hpp"
@@ -79,38 +81,97 @@ namespace MCP23017{
 
     Reg_e operator+(const RegPair_e& rp, const Port_e& p);
 
+    inline constexpr std::size_t MCP23017_nb_registers = 0x16;
+
     // I2C address (7 bits) : 00100nnn with the 3 nnn bits being hardware dependants
     inline constexpr uint16_t MCP23017_I2C_base_address = 0x20;
 
+    // IOCON register bits
+    inline constexpr uint8_t IOCON_MIRROR = 0x40; // INTA and INTB pins internally connected
+    inline constexpr uint8_t IOCON_ODR    = 0x04; // INT pins configured as open-drain outputs
+
+    // Interrupt registers state, read in one sequential transaction (INTFA..GPIOB)
+    struct Interrupt_t
+    {
+        uint8_t flags[2];    // INTFA / INTFB : pins that caused the interrupt
+        uint8_t captures[2]; // INTCAPA / INTCAPB : ports state captured at interrupt time
+        uint8_t ports[2];    // GPIOA / GPIOB : current ports state (reading it clears the interrupt)
+    };
+
     class MCP23017{
         I2CMaster::I2CDevice m_device;
-        std::map<RegPair_e, std::vector<uint8_t>> m_config;
+        // write-through shadow of the registers, indexed by Reg_e (configuration registers
+        // IODIRA..GPPUB only, the others are always read from the chip)
+        std::array<uint8_t, MCP23017_nb_registers> m_registers;
+        uint32_t m_dirty; // bit r : register r to be written (chip value differs or unknown)
         int m_timeout_ms;
         Status_e m_status;
 
+        auto on_error(const esp_err_t err_code, const char* operation, const uint8_t reg, const std::size_t nb_bytes) -> std::unexpected<esp_err_t>;
+        // bus access, shadow ignored
+        auto try_receive(const uint8_t reg, std::span<uint8_t> values, const char* operation) -> I2CMaster::I2CResult<void>;
+        // clean configuration registers from the shadow, others from the chip
+        auto try_read(const uint8_t reg, std::span<uint8_t> values, const char* operation) -> I2CMaster::I2CResult<void>;
+        // bus write of consecutive registers, shadow ignored
+        auto try_transmit(const uint8_t reg, std::span<const uint8_t> values, const char* operation) -> I2CMaster::I2CResult<void>;
+        // shadow updated, chip written unless every value is already there
+        auto try_update(const uint8_t reg, std::span<const uint8_t> values, const char* operation) -> I2CMaster::I2CResult<void>;
+        void set_shadow(const RegPair_e regs, const uint8_t value_port_a, const uint8_t value_port_b);
+        // every dirty register : IOCON, sequential write of the others, GPINTEN last
+        auto try_write_dirty(void) -> I2CMaster::I2CResult<void>;
+
     public:
         MCP23017(
             I2CMaster::I2CBus& master_bus,
             SubAddress_e device_sub_address, // 0..7 hardware configuration
             uint32_t scl_speed_hz = 100000UL,
-            int timeout_ms=-1);
+            int timeout_ms=-1,
+            bool interrupt_on_change=false); // INTA/INTB (mirrored, open-drain) on any input change
 
         MCP23017(const MCP23017&) = delete;
         MCP23017& operator=(const MCP23017&) = delete;
 
         ~MCP23017(){};
 
-        // general single register read/write
+        // general single register read/write (clean configuration registers read from the shadow,
+        // writes of the value already in the chip skipped)
         auto read_register(const Reg_e reg) -> uint8_t;
         void write_register(const Reg_e reg, const uint8_t value);
         // general register pair read/write
         auto read_registers(const RegPair_e regs) -> std::vector<uint8_t>;
         void read_registers_into(const RegPair_e regs, std::vector<uint8_t>&values);
+        void read_registers_into(const RegPair_e regs, std::span<uint8_t> values);
         void write_registers(const RegPair_e regs, const uint8_t value_port_a, const uint8_t value_port_b);
+        // consecutive registers from first in one transaction (sequential mode, IOCON.SEQOP = 0,
+        // IOCON.BANK = 0), ESP_ERR_INVALID_ARG if the block goes past the last register
+        void read_block(const Reg_e first, std::span<uint8_t> values);
+        void write_block(const Reg_e first, std::span<const uint8_t> values);
+
+        // exception-free register access (errors returned, usable with -fno-exceptions)
+        auto try_read_register(const Reg_e reg) -> I2CMaster::I2CResult<uint8_t>;
+        auto try_write_register(const Reg_e reg, const uint8_t value) -> I2CMaster::I2CResult<void>;
+        auto try_read_registers_into(const RegPair_e regs, std::span<uint8_t> values) -> I2CMaster::I2CResult<void>;
+        auto try_write_registers(const RegPair_e regs, const uint8_t value_port_a, const uint8_t value_port_b) -> I2CMaster::I2CResult<void>;
+        auto try_read_block(const Reg_e first, std::span<uint8_t> values) -> I2CMaster::I2CResult<void>;
+        auto try_write_block(const Reg_e first, std::span<const uint8_t> values) -> I2CMaster::I2CResult<void>;
 
         // Ports state
         auto read_port(const Port_e port) -> uint8_t;
         auto read_ports(void) -> std::vector<uint8_t>;
+        void read_ports_into(std::array<uint8_t, 2>& ports); // allocation-free (scan hot path)
+        auto try_read_ports_into(std::array<uint8_t, 2>& ports) -> I2CMaster::I2CResult<void>;
+        // asynchronous ports read (bus in asynchronous mode) : ports filled when the done
+        // callback is called, then check_async() updates the status
+        void set_async_callback(I2CMaster::TransDoneCallback callback, void* arg);
+        auto read_ports_async(std::array<uint8_t, 2>& ports) -> I2CMaster::I2CResult<void>;
+        auto check_async(void) -> bool;
+        // queued read not done in time : device marked disconnected (check_status() reconnects it)
+        void abort_async(void);
+
+        // Interrupts
+        void set_interrupts(const uint8_t enable_port_a, const uint8_t enable_port_b);
+        auto read_interrupt(void) -> Interrupt_t;
+        auto try_read_interrupt(void) -> I2CMaster::I2CResult<Interrupt_t>;
 
         // Device configuration
         // Ports direction
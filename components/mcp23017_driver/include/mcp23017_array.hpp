@@ -0,0 +1,351 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <optional>
+#include <utility>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "mcp23017.hpp"
+
+namespace MCP23017{
+
+    // Per chip health counters
+    struct ChipHealth_t
+    {
+        uint32_t nb_reads;      // ports reads attempted
+        uint32_t nb_errors;     // failed reads (chip marked disconnected)
+        uint32_t nb_reconnects; // disconnected -> ready transitions
+    };
+
+    // Scan pass duration statistics (microseconds)
+    struct ScanTime_t
+    {
+        uint32_t nb_scans;
+        int64_t min_us;
+        int64_t max_us;
+        int64_t mean_us;
+    };
+
+    // Up to 8 MCP23017 on one bus (sub addresses 0..NbChips-1), read in one scan pass.
+    // Chip i ports A / B are the inputs 16 * i .. 16 * i + 15 of the packed inputs word.
+    template<std::size_t NbChips>
+    class ExpanderArray{
+        static_assert((NbChips >= 1) && (NbChips <= 8), "MCP23017 : 8 sub addresses available");
+
+    public:
+        static constexpr std::size_t NbInputs = NbChips * 16;
+        using Inputs = std::array<uint32_t, (NbInputs + 31) / 32>;
+        using Ports = std::array<uint8_t, 2>;
+        // I2C ISR context : the last queued ports read is done
+        using ScanDoneCallback = bool (*)(void* arg);
+
+        // statistics snapshot, to be logged by another (low priority) task
+        struct Stats_t
+        {
+            ScanTime_t scan_time;
+            std::array<ChipHealth_t, NbChips> health;
+            std::array<Status_e, NbChips> status;
+        };
+
+    private:
+        static constexpr const char* TAG = "MCP23017:array";
+
+        // asynchronous read of one chip, done callback argument
+        struct AsyncRead_t
+        {
+            ExpanderArray* array;
+            std::atomic<bool> pending;
+        };
+
+        std::array<std::optional<MCP23017>, NbChips> m_chips;
+        std::array<Ports, NbChips> m_ports;   // last known ports states
+        std::array<ChipHealth_t, NbChips> m_health;
+        Inputs m_inputs;
+
+        // interrupt registers of the last scan_interrupts()
+        std::array<Interrupt_t, NbChips> m_interrupts;
+        std::array<int64_t, NbChips> m_interrupts_read_us;
+        uint32_t m_interrupts_read;
+
+        std::array<AsyncRead_t, NbChips> m_async;
+        std::atomic<uint8_t> m_reads_pending;
+        ScanDoneCallback m_scan_done_callback;
+        void* m_scan_done_callback_arg;
+        int64_t m_scan_start_us;
+
+        ScanTime_t m_scan_time;
+        int64_t m_sum_scan_us;
+
+        static bool on_read_done(bool success, void* arg)
+        {
+            // Only the queued ports reads are counted (not the blocking config writes)
+            AsyncRead_t* read = static_cast<AsyncRead_t*>(arg);
+            ExpanderArray* array = read->array;
+            if (read->pending.exchange(false) && (array->m_reads_pending.fetch_sub(1) == 1)
+                && (array->m_scan_done_callback != NULL)){
+                return array->m_scan_done_callback(array->m_scan_done_callback_arg);
+            }
+            return false;
+        }
+
+        // disconnected chip : reconnection attempt, true if ready again
+        bool reconnect(std::size_t c)
+        {
+            m_chips[c]->check_status();
+            if (m_chips[c]->get_status() == Status_e::STS_READY){
+                m_health[c].nb_reconnects++;
+                ESP_LOGI(TAG, "chip %u ready", static_cast<unsigned>(c));
+                return true;
+            }
+            m_ports[c] = {0x00, 0x00};  // default inputs states if chip unavailable
+            return false;
+        }
+
+        void read_chip(std::size_t c)
+        {
+            m_health[c].nb_reads++;
+            if (!m_chips[c]->try_read_ports_into(m_ports[c])){
+                m_health[c].nb_errors++;
+            }
+        }
+
+        void read_chip_interrupt(std::size_t c)
+        {
+            m_health[c].nb_reads++;
+            const auto interrupt = m_chips[c]->try_read_interrupt();
+            if (interrupt){
+                m_ports[c] = {interrupt->ports[0], interrupt->ports[1]};
+                m_interrupts[c] = *interrupt;
+                m_interrupts_read_us[c] = esp_timer_get_time();
+                m_interrupts_read |= 1u << c;
+            } else {
+                m_health[c].nb_errors++;
+                m_ports[c] = {0x00, 0x00};
+            }
+        }
+
+        auto pack(int64_t start_us) -> const Inputs&
+        {
+            m_inputs.fill(0);
+            for (std::size_t c = 0; c < NbChips; c++){
+                const uint32_t chip_inputs = m_ports[c][0] | (uint32_t{m_ports[c][1]} << 8);
+                m_inputs[c / 2] |= chip_inputs << ((c % 2) * 16);
+            }
+            const int64_t scan_us = esp_timer_get_time() - start_us;
+            m_scan_time.nb_scans++;
+            m_scan_time.min_us = std::min(m_scan_time.min_us, scan_us);
+            m_scan_time.max_us = std::max(m_scan_time.max_us, scan_us);
+            m_sum_scan_us += scan_us;
+            return m_inputs;
+        }
+
+    public:
+        ExpanderArray(
+            I2CMaster::I2CBus& master_bus,
+            uint32_t scl_speed_hz = 100000UL,
+            int timeout_ms=-1,
+            bool interrupt_on_change=false)
+            :m_ports{},
+            m_health{},
+            m_inputs{},
+            m_interrupts{},
+            m_interrupts_read_us{},
+            m_interrupts_read{0},
+            m_reads_pending{0},
+            m_scan_done_callback{NULL},
+            m_scan_done_callback_arg{NULL},
+            m_scan_start_us{0}
+        {
+            for (std::size_t c = 0; c < NbChips; c++){
+                m_chips[c].emplace(master_bus, static_cast<SubAddress_e>(c), scl_speed_hz, timeout_ms, interrupt_on_change);
+                m_async[c].array = this;
+                m_async[c].pending = false;
+            }
+            reset_stats();
+        }
+
+        ExpanderArray(const ExpanderArray&) = delete;
+        ExpanderArray& operator=(const ExpanderArray&) = delete;
+
+        auto chip(std::size_t c) -> MCP23017& {return *m_chips[c];}
+        static constexpr auto nb_chips(void) -> std::size_t {return NbChips;}
+
+        // same configuration for every chip
+        void set_config(
+            const uint8_t direction_port_a, const uint8_t direction_port_b,
+            const uint8_t polarity_port_a, const uint8_t polarity_port_b,
+            const uint8_t pullups_port_a, const uint8_t pullups_port_b)
+        {
+            for (auto& chip : m_chips){
+                chip->set_config(direction_port_a, direction_port_b, polarity_port_a, polarity_port_b, pullups_port_a, pullups_port_b);
+            }
+        }
+
+        // Blocking scan : ports of every chip read
+        auto scan(void) -> const Inputs&
+        {
+            const int64_t start_us = esp_timer_get_time();
+            for (std::size_t c = 0; c < NbChips; c++){
+                if ((m_chips[c]->get_status() == Status_e::STS_READY) || reconnect(c)){
+                    read_chip(c);
+                }
+            }
+            return pack(start_us);
+        }
+
+        // Interrupt driven scan : only the chips of chips_mask (bit c : INT of chip c active)
+        // are read, clearing their interrupt. The others keep their last known state.
+        auto scan_interrupts(uint32_t chips_mask) -> const Inputs&
+        {
+            const int64_t start_us = esp_timer_get_time();
+            m_interrupts_read = 0;
+            for (std::size_t c = 0; c < NbChips; c++){
+                if (m_chips[c]->get_status() != Status_e::STS_READY){
+                    if (reconnect(c)){
+                        // (re)connected : initial ports state, no interrupt pending yet
+                        read_chip(c);
+                    }
+                } else if (chips_mask & (1u << c)){
+                    read_chip_interrupt(c);
+                }
+            }
+            return pack(start_us);
+        }
+
+        // Asynchronous scan (bus in asynchronous mode) : all ports reads queued at once,
+        // callback called from the I2C ISR when the last one is done.
+        void set_scan_done_callback(ScanDoneCallback callback, void* arg)
+        {
+            m_scan_done_callback_arg = arg;
+            m_scan_done_callback = callback;
+            for (std::size_t c = 0; c < NbChips; c++){
+                m_chips[c]->set_async_callback(on_read_done, &m_async[c]);
+            }
+        }
+
+        // returns true if reads are still in flight (wait for the callback), then scan_async_result()
+        auto scan_async(void) -> bool
+        {
+            m_scan_start_us = esp_timer_get_time();
+            m_reads_pending = 1;  // guard : no callback until every read is queued
+            for (std::size_t c = 0; c < NbChips; c++){
+                if ((m_chips[c]->get_status() != Status_e::STS_READY) && !reconnect(c)){
+                    continue;
+                }
+                m_health[c].nb_reads++;
+                m_reads_pending++;
+                m_async[c].pending = true;
+                if (!m_chips[c]->read_ports_async(m_ports[c])){
+                    m_async[c].pending = false;
+                    m_reads_pending--;
+                    m_health[c].nb_errors++;
+                    m_ports[c] = {0x00, 0x00};
+                }
+            }
+            return m_reads_pending.fetch_sub(1) != 1;
+        }
+
+        // done callback not called in time : the reads still pending count as failed,
+        // their chips are reconnected by the next scans (late callbacks ignored)
+        void scan_async_timeout(void)
+        {
+            for (std::size_t c = 0; c < NbChips; c++){
+                if (m_async[c].pending.exchange(false)){
+                    m_health[c].nb_errors++;
+                    m_chips[c]->abort_async();
+                    m_ports[c] = {0x00, 0x00};
+                }
+            }
+            m_reads_pending = 0;
+        }
+
+        auto scan_async_result(void) -> const Inputs&
+        {
+            for (std::size_t c = 0; c < NbChips; c++){
+                if ((m_chips[c]->get_status() == Status_e::STS_READY) && !m_chips[c]->check_async()){
+                    m_health[c].nb_errors++;
+                    m_ports[c] = {0x00, 0x00};
+                }
+            }
+            return pack(m_scan_start_us);
+        }
+
+        auto inputs(void) const -> const Inputs& {return m_inputs;}
+        // chips whose interrupt registers were read by the last scan_interrupts() (bit c : chip c),
+        // their INTF / INTCAP / GPIO values and the time they were read (interrupt cleared)
+        auto interrupts_read(void) const -> uint32_t {return m_interrupts_read;}
+        auto interrupt(std::size_t c) const -> const Interrupt_t& {return m_interrupts[c];}
+        auto interrupt_read_us(std::size_t c) const -> int64_t {return m_interrupts_read_us[c];}
+        auto health(std::size_t c) const -> const ChipHealth_t& {return m_health[c];}
+        auto status(std::size_t c) -> Status_e {return m_chips[c]->get_status();}
+
+        auto scan_time(void) const -> ScanTime_t
+        {
+            ScanTime_t result = m_scan_time;
+            if (result.nb_scans > 0){
+                result.mean_us = m_sum_scan_us / result.nb_scans;
+            } else {
+                result.min_us = 0;
+            }
+            return result;
+        }
+
+        void reset_stats(void)
+        {
+            m_scan_time = ScanTime_t{0, INT64_MAX, 0, 0};
+            m_sum_scan_us = 0;
+        }
+
+        auto stats(void) -> Stats_t
+        {
+            Stats_t result{scan_time(), m_health, {}};
+            for (std::size_t c = 0; c < NbChips; c++){
+                result.status[c] = m_chips[c]->get_status();
+            }
+            return result;
+        }
+
+        static void log_stats(const Stats_t& stats)
+        {
+            const ScanTime_t& t = stats.scan_time;
+            ESP_LOGI(TAG, "%u chip(s) : %lu scans, min %lld / mean %lld / max %lld us",
+                static_cast<unsigned>(NbChips), static_cast<unsigned long>(t.nb_scans),
+                static_cast<long long>(t.min_us), static_cast<long long>(t.mean_us), static_cast<long long>(t.max_us));
+            for (std::size_t c = 0; c < NbChips; c++){
+                const ChipHealth_t& health = stats.health[c];
+                if ((health.nb_errors > 0) || (stats.status[c] != Status_e::STS_READY)){
+                    ESP_LOGI(TAG, "chip %u : %s, %lu reads, %lu errors, %lu reconnects", static_cast<unsigned>(c),
+                        (stats.status[c] == Status_e::STS_READY) ? "ready" : "not ready",
+                        static_cast<unsigned long>(health.nb_reads),
+                        static_cast<unsigned long>(health.nb_errors),
+                        static_cast<unsigned long>(health.nb_reconnects));
+                }
+            }
+        }
+
+        void log_stats(void) {log_stats(stats());}
+
+        // Blocking scan time as a function of the chips count : nb_scans ports reads
+        // of the first 1, 2, .. NbChips chips. Returns the mean scan time (us) per count.
+        auto measure_scan_time(uint32_t nb_scans) -> std::array<int64_t, NbChips>
+        {
+            std::array<int64_t, NbChips> mean_us{};
+            for (std::size_t n = 1; n <= NbChips; n++){
+                const int64_t start_us = esp_timer_get_time();
+                for (uint32_t s = 0; s < nb_scans; s++){
+                    for (std::size_t c = 0; c < n; c++){
+                        Ports ports;
+                        m_chips[c]->try_read_ports_into(ports);
+                    }
+                }
+                mean_us[n - 1] = (esp_timer_get_time() - start_us) / std::max<uint32_t>(nb_scans, 1);
+                ESP_LOGI(TAG, "scan time %u chip(s) : %lld us", static_cast<unsigned>(n), static_cast<long long>(mean_us[n - 1]));
+            }
+            return mean_us;
+        }
+    };
+
+} // namespace
@@ -1,5 +1,6 @@
+#include <algorithm>
+#include <bit>
 #include <utility>
-#include <sstream>
 #include "esp_log.h"
 #include "mcp23017.hpp"
 
@@ -9,114 +10,277 @@ MCP23017::Reg_e MCP23017::operator+(const RegPair_e& rp, const Port_e& p){
     return static_cast<Reg_e>(std::to_underlying(rp)+std::to_underlying(p));
 }
 
+// registers values at power-on/reset : all pins inputs, everything else cleared
+static constexpr std::array<uint8_t, MCP23017::MCP23017_nb_registers> por_registers{0xFF, 0xFF};
+
+// configuration registers IODIRA..GPPUB, kept in the shadow
+static constexpr uint8_t nb_config_registers = std::to_underlying(MCP23017::Reg_e::REG_GPPUB) + 1;
+
+static constexpr uint32_t reg_mask(const uint8_t reg, const std::size_t nb_regs)
+{
+    return ((1u << nb_regs) - 1) << reg;
+}
+
+static constexpr uint32_t shadow_mask = reg_mask(0, nb_config_registers);
+
+// registers reg..reg+nb_regs-1 exist : bounds of the shadow and of the write buffer
+static constexpr bool in_registers(const uint8_t reg, const std::size_t nb_regs)
+{
+    return (reg < MCP23017::MCP23017_nb_registers) && (nb_regs <= MCP23017::MCP23017_nb_registers - reg);
+}
+
 // constructor
 MCP23017::MCP23017::MCP23017(
     I2CMaster::I2CBus& master_bus,
     SubAddress_e device_sub_address,
     uint32_t scl_speed_hz,
-    int timeout_ms)
+    int timeout_ms,
+    bool interrupt_on_change)
     :m_device(
         master_bus,
         MCP23017_I2C_base_address + std::to_underlying(device_sub_address), // I2C address (7 bits) : 00100nnn with the 3 nnn bits hardware dependants
         scl_speed_hz,
         I2C_ADDR_BIT_LEN_7),
-    m_config{ // registers values at power-on/reset
-        {RegPair_e::REGS_IODIR, {0xFF, 0xFF}},
-        {RegPair_e::REGS_IPOL, {0x00, 0x00}},
-        {RegPair_e::REGS_GPPU, {0x00, 0x00}}},
+    m_registers{por_registers},
+    // chip state unknown (may be left configured by an ESP only reset) : pins configuration written once
+    m_dirty{reg_mask(std::to_underlying(RegPair_e::REGS_IODIR), 2)
+        | reg_mask(std::to_underlying(RegPair_e::REGS_IPOL), 2)
+        | reg_mask(std::to_underlying(RegPair_e::REGS_GPPU), 2)},
     m_timeout_ms{timeout_ms},
     m_status{Status_e::STS_DISCONNECTED}
 {
+    if (interrupt_on_change){
+        // interrupt on change from previous pin value (INTCON = 0, DEFVAL unused : not written)
+        set_shadow(RegPair_e::REGS_GPINTEN, 0xFF, 0xFF);
+        m_dirty |= reg_mask(std::to_underlying(RegPair_e::REGS_INTCON), 2);
+        // both ports on each INT pin, open-drain to allow wired-OR INT lines
+        set_shadow(RegPair_e::REGS_ICON, IOCON_MIRROR | IOCON_ODR, IOCON_MIRROR | IOCON_ODR);
+    }
+}
+
+// Legacy API : bus errors only update the status, driver errors are (re)thrown
+template<typename T>
+static void throw_on_driver_error(const I2CMaster::I2CResult<T>& result)
+{
+#if __cpp_exceptions
+    if (!result && !I2CMaster::is_bus_error(result.error())){
+        throw I2CMaster::I2CDriverException();
+    }
+#endif
+}
+
+// any I2C error marks the device as disconnected (check_status() will reconnect it)
+auto MCP23017::MCP23017::on_error(const esp_err_t err_code, const char* operation, const uint8_t reg, const std::size_t nb_bytes) -> std::unexpected<esp_err_t>
+{
+    m_status = Status_e::STS_DISCONNECTED;
+    if (!I2CMaster::is_bus_error(err_code)){
+        ESP_LOGI(TAG, "%s failed: %zu byte(s) @%u (%s)", operation, nb_bytes, reg, esp_err_to_name(err_code));
+    }
+    return std::unexpected(err_code);
+}
+
+auto MCP23017::MCP23017::try_receive(const uint8_t reg, std::span<uint8_t> values, const char* operation) -> I2CMaster::I2CResult<void>
+{
+    const std::array<uint8_t, 1> address{reg};
+    const auto result = m_device.try_transmit_receive_in(address, values, m_timeout_ms);
+    if (!result){
+        return on_error(result.error(), operation, reg, values.size());
+    }
+    return {};
+}
+
+auto MCP23017::MCP23017::try_read(const uint8_t reg, std::span<uint8_t> values, const char* operation) -> I2CMaster::I2CResult<void>
+{
+    // dirty : value in the chip unknown until written, read from the chip
+    if ((reg + values.size() <= nb_config_registers) && !(m_dirty & reg_mask(reg, values.size()))){
+        std::copy_n(m_registers.begin() + reg, values.size(), values.begin());
+        return {};
+    }
+    return try_receive(reg, values, operation);
+}
+
+auto MCP23017::MCP23017::try_update(const uint8_t reg, std::span<const uint8_t> values, const char* operation) -> I2CMaster::I2CResult<void>
+{
+    if (!in_registers(reg, values.size())){
+        return std::unexpected(ESP_ERR_INVALID_ARG);
+    }
+    const uint32_t mask = reg_mask(reg, values.size());
+    if (((mask & shadow_mask) == mask) && !(m_dirty & mask)
+        && std::equal(values.begin(), values.end(), m_registers.begin() + reg)){
+        return {}; // already in the chip
+    }
+    if (values.data() != m_registers.data() + reg){
+        std::copy(values.begin(), values.end(), m_registers.begin() + reg);
+    }
+    // still dirty if the write fails : written again by check_status()
+    m_dirty |= mask & shadow_mask;
+    const auto result = try_transmit(reg, values, operation);
+    if (result){
+        m_dirty &= ~mask;
+    }
+    return result;
+}
+
+auto MCP23017::MCP23017::try_transmit(const uint8_t reg, std::span<const uint8_t> values, const char* operation) -> I2CMaster::I2CResult<void>
+{
+    if (!in_registers(reg, values.size())){
+        return std::unexpected(ESP_ERR_INVALID_ARG);
+    }
+    std::array<uint8_t, MCP23017_nb_registers + 1> data;
+    data[0] = reg;
+    std::copy(values.begin(), values.end(), data.begin() + 1);
+    const auto result = m_device.try_transmit(std::span{data}.first(values.size() + 1), m_timeout_ms);
+    if (!result){
+        return on_error(result.error(), operation, reg, values.size());
+    }
+    return {};
+}
+
+// Interrupts enabled last, once the INT pins and the inputs are configured : IOCON first
+// (INT open-drain), then one sequential write of the other dirty registers with GPINTEN
+// kept disabled, then GPINTEN
+auto MCP23017::MCP23017::try_write_dirty(void) -> I2CMaster::I2CResult<void>
+{
+    constexpr uint8_t iocon = std::to_underlying(RegPair_e::REGS_ICON);
+    constexpr uint8_t gpinten = std::to_underlying(RegPair_e::REGS_GPINTEN);
+    const uint32_t gpinten_mask = reg_mask(gpinten, 2);
+
+    if (m_dirty & reg_mask(iocon, 2)){
+        const auto result = try_update(iocon, std::span{m_registers}.subspan(iocon, 2), "write_config");
+        if (!result){
+            return result;
+        }
+    }
+    const uint32_t gpinten_dirty = m_dirty & gpinten_mask;
+    const uint32_t dirty = m_dirty & shadow_mask & ~gpinten_mask;
+    if (dirty != 0){
+        // the clean registers in between are written with the value already in the chip
+        const uint8_t first = std::countr_zero(dirty);
+        const uint8_t last = std::bit_width(dirty) - 1;
+        std::array<uint8_t, nb_config_registers> values;
+        std::copy(m_registers.begin() + first, m_registers.begin() + last + 1, values.begin());
+        for (uint8_t reg = std::max(first, gpinten); reg <= std::min<uint8_t>(last, gpinten + 1); reg++){
+            if (gpinten_dirty & reg_mask(reg, 1)){
+                values[reg - first] = 0x00;
+            }
+        }
+        const auto result = try_transmit(first, std::span{values}.first(last - first + 1), "write_config");
+        if (!result){
+            return result;
+        }
+        m_dirty &= ~(reg_mask(first, last - first + 1) & ~gpinten_dirty);
+    }
+    if (gpinten_dirty){
+        return try_update(gpinten, std::span{m_registers}.subspan(gpinten, 2), "write_config");
+    }
+    return {};
+}
+
+// shadow only, dirty if changed (written by write_config())
+void MCP23017::MCP23017::set_shadow(const RegPair_e regs, const uint8_t value_port_a, const uint8_t value_port_b)
+{
+    const uint8_t reg = std::to_underlying(regs);
+    const std::array<uint8_t, 2> values{value_port_a, value_port_b};
+    for (std::size_t p = 0; p < values.size(); p++){
+        if (m_registers[reg + p] != values[p]){
+            m_registers[reg + p] = values[p];
+            m_dirty |= reg_mask(reg + p, 1);
+        }
+    }
 }
 
 // general single register read/write
 auto MCP23017::MCP23017::read_register(const Reg_e reg) -> uint8_t
 {
-    try {
-        auto data = m_device.transmit_receive(std::vector<uint8_t>{std::to_underlying(reg)}, 1, m_timeout_ms);
-        return data[0];
-    } catch (I2CMaster::I2CBusErrorException& e) {
-        m_status = Status_e::STS_DISCONNECTED;
-        return 0;
-    } catch ( ... )
-    {
-        // everything else
-        m_status = Status_e::STS_DISCONNECTED;
-        std::stringstream ss;
-        ss << "read_register failed: 1 byte @" << +std::to_underlying(reg);
-        ESP_LOGI(TAG, "%s", ss.str().c_str());
-        throw;
-    }
+    const auto value = try_read_register(reg);
+    throw_on_driver_error(value);
+    return value.value_or(0);
 }
 
 void MCP23017::MCP23017::write_register(const Reg_e reg, const uint8_t value)
 {
-    try{
-        m_device.transmit(std::vector<uint8_t>{std::to_underlying(reg), value}, m_timeout_ms);
-    } catch (I2CMaster::I2CBusErrorException& e) {
-        m_status = Status_e::STS_DISCONNECTED;
-    } catch ( ... )
-    {
-        // everything else
-        m_status = Status_e::STS_DISCONNECTED;
-        std::stringstream ss;
-        ss << "write_register failed: [" << std::hex << +value << std::dec << "] byte @" << +std::to_underlying(reg);
-        ESP_LOGI(TAG, "%s", ss.str().c_str());
-        throw;
-    }
+    throw_on_driver_error(try_write_register(reg, value));
 }
 
 // general register pair read/write
 auto MCP23017::MCP23017::read_registers(const RegPair_e regs) -> std::vector<uint8_t>
 {
-    try{
-        return m_device.transmit_receive(std::vector<uint8_t>{std::to_underlying(regs)}, 2, m_timeout_ms);
-    } catch (I2CMaster::I2CBusErrorException& e) {
-        m_status = Status_e::STS_DISCONNECTED;
+    std::vector<uint8_t> values(2);
+    const auto result = try_read_registers_into(regs, values);
+    throw_on_driver_error(result);
+    if (!result){
         return std::vector<uint8_t>{0, 0};
-    } catch ( ... )
-    {
-        // everything else
-        m_status = Status_e::STS_DISCONNECTED;
-        std::stringstream ss;
-        ss << "read_registers failed: 2 bytes @" << +std::to_underlying(regs);
-        ESP_LOGI(TAG, "%s", ss.str().c_str());
-        throw;
     }
+    return values;
 }
 
 void MCP23017::MCP23017::read_registers_into(const RegPair_e regs, std::vector<uint8_t>&values)
 {
-    try{
-        m_device.transmit_receive_in(std::vector<uint8_t>{std::to_underlying(regs)}, values, m_timeout_ms);
-    } catch (I2CMaster::I2CBusErrorException& e) {
-        m_status = Status_e::STS_DISCONNECTED;
-    } catch ( ... )
-    {
-        // everything else
-        m_status = Status_e::STS_DISCONNECTED;
-        std::stringstream ss;
-        ss << "read_registers_into failed: " << +values.size() << " byte(s) @" << +std::to_underlying(regs);
-        ESP_LOGI(TAG, "%s", ss.str().c_str());
-        throw;
-    }
+    read_registers_into(regs, std::span<uint8_t>{values});
+}
+
+void MCP23017::MCP23017::read_registers_into(const RegPair_e regs, std::span<uint8_t> values)
+{
+    throw_on_driver_error(try_read_registers_into(regs, values));
 }
 
 void MCP23017::MCP23017::write_registers(const RegPair_e regs, const uint8_t value_port_a, const uint8_t value_port_b)
 {
-    try{
-        m_device.transmit(std::vector<uint8_t>{std::to_underlying(regs), value_port_a, value_port_b}, m_timeout_ms);
-    } catch (I2CMaster::I2CBusErrorException& e) {
-        m_status = Status_e::STS_DISCONNECTED;
-    } catch ( ... )
-    {
-        // everything else
-        m_status = Status_e::STS_DISCONNECTED;
-        std::stringstream ss;
-        ss << "write_registers failed: [" << std::hex << +value_port_a << ", " << +value_port_b << std::dec << "] bytes @" << +std::to_underlying(regs);
-        ESP_LOGI(TAG, "%s", ss.str().c_str());
-        throw;
+    throw_on_driver_error(try_write_registers(regs, value_port_a, value_port_b));
+}
+
+void MCP23017::MCP23017::read_block(const Reg_e first, std::span<uint8_t> values)
+{
+    throw_on_driver_error(try_read_block(first, values));
+}
+
+void MCP23017::MCP23017::write_block(const Reg_e first, std::span<const uint8_t> values)
+{
+    throw_on_driver_error(try_write_block(first, values));
+}
+
+// exception-free register access
+auto MCP23017::MCP23017::try_read_register(const Reg_e reg) -> I2CMaster::I2CResult<uint8_t>
+{
+    std::array<uint8_t, 1> data{};
+    const auto result = try_read(std::to_underlying(reg), data, "read_register");
+    if (!result){
+        return std::unexpected(result.error());
     }
+    return data[0];
+}
+
+auto MCP23017::MCP23017::try_write_register(const Reg_e reg, const uint8_t value) -> I2CMaster::I2CResult<void>
+{
+    const std::array<uint8_t, 1> values{value};
+    return try_update(std::to_underlying(reg), values, "write_register");
+}
+
+auto MCP23017::MCP23017::try_read_registers_into(const RegPair_e regs, std::span<uint8_t> values) -> I2CMaster::I2CResult<void>
+{
+    if (!in_registers(std::to_underlying(regs), values.size())){
+        return std::unexpected(ESP_ERR_INVALID_ARG);
+    }
+    return try_read(std::to_underlying(regs), values, "read_registers");
+}
+
+auto MCP23017::MCP23017::try_write_registers(const RegPair_e regs, const uint8_t value_port_a, const uint8_t value_port_b) -> I2CMaster::I2CResult<void>
+{
+    const std::array<uint8_t, 2> values{value_port_a, value_port_b};
+    return try_update(std::to_underlying(regs), values, "write_registers");
+}
+
+auto MCP23017::MCP23017::try_read_block(const Reg_e first, std::span<uint8_t> values) -> I2CMaster::I2CResult<void>
+{
+    if (!in_registers(std::to_underlying(first), values.size())){
+        return std::unexpected(ESP_ERR_INVALID_ARG);
+    }
+    return try_read(std::to_underlying(first), values, "read_block");
+}
+
+auto MCP23017::MCP23017::try_write_block(const Reg_e first, std::span<const uint8_t> values) -> I2CMaster::I2CResult<void>
+{
+    return try_update(std::to_underlying(first), values, "write_block");
 }
 
 // Ports state
@@ -130,53 +294,120 @@ auto MCP23017::MCP23017::read_ports(void) -> std::vector<uint8_t>
     return read_registers(RegPair_e::REGS_GPIO);
 }
 
+void MCP23017::MCP23017::read_ports_into(std::array<uint8_t, 2>& ports)
+{
+    throw_on_driver_error(try_read_ports_into(ports));
+}
+
+auto MCP23017::MCP23017::try_read_ports_into(std::array<uint8_t, 2>& ports) -> I2CMaster::I2CResult<void>
+{
+    const auto result = try_read_registers_into(RegPair_e::REGS_GPIO, ports);
+    if (!result){
+        ports = {0x00, 0x00}; // same as read_ports() on bus error
+    }
+    return result;
+}
+
+void MCP23017::MCP23017::set_async_callback(I2CMaster::TransDoneCallback callback, void* arg)
+{
+    m_device.set_done_callback(callback, arg);
+}
+
+auto MCP23017::MCP23017::read_ports_async(std::array<uint8_t, 2>& ports) -> I2CMaster::I2CResult<void>
+{
+    // register address must outlive the queued transaction
+    static constexpr std::array<uint8_t, 1> address{std::to_underlying(RegPair_e::REGS_GPIO)};
+    const auto result = m_device.transmit_receive_async(address, ports);
+    if (!result){
+        return on_error(result.error(), "read_ports_async", address[0], ports.size());
+    }
+    return {};
+}
+
+auto MCP23017::MCP23017::check_async(void) -> bool
+{
+    if (m_device.async_failed()){
+        m_status = Status_e::STS_DISCONNECTED;
+        return false;
+    }
+    return true;
+}
+
+void MCP23017::MCP23017::abort_async(void)
+{
+    m_status = Status_e::STS_DISCONNECTED;
+}
+
+// Interrupts
+void MCP23017::MCP23017::set_interrupts(const uint8_t enable_port_a, const uint8_t enable_port_b)
+{
+    write_registers(RegPair_e::REGS_ICON, IOCON_MIRROR | IOCON_ODR, IOCON_MIRROR | IOCON_ODR);
+    write_registers(RegPair_e::REGS_INTCON, 0x00, 0x00);
+    write_registers(RegPair_e::REGS_GPINTEN, enable_port_a, enable_port_b);
+}
+
+auto MCP23017::MCP23017::read_interrupt(void) -> Interrupt_t
+{
+    const auto interrupt = try_read_interrupt();
+    throw_on_driver_error(interrupt);
+    return interrupt.value_or(Interrupt_t{});
+}
+
+auto MCP23017::MCP23017::try_read_interrupt(void) -> I2CMaster::I2CResult<Interrupt_t>
+{
+    // INTFA, INTFB, INTCAPA, INTCAPB, GPIOA, GPIOB (sequential mode, IOCON.BANK = 0)
+    std::array<uint8_t, 6> data{};
+    const auto result = try_read_registers_into(RegPair_e::REGS_INTFA, data);
+    if (!result){
+        return std::unexpected(result.error());
+    }
+    return Interrupt_t{{data[0], data[1]}, {data[2], data[3]}, {data[4], data[5]}};
+}
+
 // Ports direction
 void MCP23017::MCP23017::set_port_direction(const Port_e port, const uint8_t direction)
 {
-    m_config[RegPair_e::REGS_IODIR][std::to_underlying(port)] = direction;
     write_register(RegPair_e::REGS_IODIR + port, direction);
 }
 
 void MCP23017::MCP23017::set_ports_direction(const uint8_t direction_port_a, const uint8_t direction_port_b)
 {
-    m_config[RegPair_e::REGS_IODIR][0] = direction_port_a;
-    m_config[RegPair_e::REGS_IODIR][1] = direction_port_b;
     write_registers(RegPair_e::REGS_IODIR, direction_port_a, direction_port_b);
 }
 
 // Ports polarity
 void MCP23017::MCP23017::set_port_polarity(const Port_e port, const uint8_t polarity)
 {
-    m_config[RegPair_e::REGS_IPOL][std::to_underlying(port)] = polarity;
     write_register(RegPair_e::REGS_IPOL + port, polarity);
 }
 
 void MCP23017::MCP23017::set_ports_polarity(const uint8_t polarity_port_a, const uint8_t polarity_port_b)
 {
-    m_config[RegPair_e::REGS_IPOL][0] = polarity_port_a;
-    m_config[RegPair_e::REGS_IPOL][1] = polarity_port_b;
     write_registers(RegPair_e::REGS_IPOL, polarity_port_a, polarity_port_b);
 }
 
 // Ports pullups
 void MCP23017::MCP23017::set_port_pullups(const Port_e port, const uint8_t pullups)
 {
-    m_config[RegPair_e::REGS_GPPU][std::to_underlying(port)] = pullups;
     write_register(RegPair_e::REGS_GPPU + port, pullups);
 }
 
 void MCP23017::MCP23017::set_ports_pullups(const uint8_t pullups_port_a, const uint8_t pullups_port_b)
 {
-    m_config[RegPair_e::REGS_GPPU][0] = pullups_port_a;
-    m_config[RegPair_e::REGS_GPPU][1] = pullups_port_b;
     write_registers(RegPair_e::REGS_GPPU, pullups_port_a, pullups_port_b);
 }
 
+// shadow reloaded from the chip, one sequential read
 void MCP23017::MCP23017::read_config(void)
 {
-    for (auto& cfg_pair : m_config){
-        read_registers_into(cfg_pair.first, cfg_pair.second);
+    std::array<uint8_t, nb_config_registers> values{};
+    const auto result = try_receive(0, values, "read_config");
+    throw_on_driver_error(result);
+    if (!result){
+        return;
     }
+    std::copy(values.begin(), values.end(), m_registers.begin());
+    m_dirty &= ~shadow_mask;
 }
 
 void MCP23017::MCP23017::set_config(
@@ -184,32 +415,35 @@ void MCP23017::MCP23017::set_config(
     const uint8_t polarity_port_a, const uint8_t polarity_port_b,
     const uint8_t pullups_port_a, const uint8_t pullups_port_b)
 {
-    m_config[RegPair_e::REGS_IODIR][0] = direction_port_a;
-    m_config[RegPair_e::REGS_IODIR][1] = direction_port_b;
-    m_config[RegPair_e::REGS_IPOL][0] = polarity_port_a;
-    m_config[RegPair_e::REGS_IPOL][1] = polarity_port_b;
-    m_config[RegPair_e::REGS_GPPU][0] = pullups_port_a;
-    m_config[RegPair_e::REGS_GPPU][1] = pullups_port_b;
+    set_shadow(RegPair_e::REGS_IODIR, direction_port_a, direction_port_b);
+    set_shadow(RegPair_e::REGS_IPOL, polarity_port_a, polarity_port_b);
+    set_shadow(RegPair_e::REGS_GPPU, pullups_port_a, pullups_port_b);
     write_config();
 }
 
+// dirty registers only : IOCON, one sequential write, GPINTEN
 void MCP23017::MCP23017::write_config(void)
 {
     m_status = Status_e::STS_READY;
     // if the upcoming write fail, m_status will be set to STS_DISCONNECTED
-    for (const auto& [rp, rp_values] : m_config){
-        write_registers(rp, rp_values[0], rp_values[1]);
-    }
+    throw_on_driver_error(try_write_dirty());
 }
 
 void MCP23017::MCP23017::check_status(void)
 {
     if (m_status == Status_e::STS_DISCONNECTED){
         m_status = Status_e::STS_CONNECTED;
-        // if the read fail, m_status will be set to STS_DISCONNECTED
-        uint8_t reg_icon_a = read_register(Reg_e::REG_ICONA);
+        // bus read (not the shadow), if it fails m_status will be set to STS_DISCONNECTED
+        std::array<uint8_t, 1> reg_icon_a{};
+        throw_on_driver_error(try_receive(std::to_underlying(Reg_e::REG_ICONA), reg_icon_a, "read_register"));
     }
     if (m_status == Status_e::STS_CONNECTED){
+        // the chip may have been power cycled : registers differing from their power-on value written again
+        for (uint8_t reg = 0; reg < nb_config_registers; reg++){
+            if (m_registers[reg] != por_registers[reg]){
+                m_dirty |= reg_mask(reg, 1);
+            }
+        }
         write_config(); // sets m_status to STS_READY / STS_DISCONNECTED if fail
     }
 }
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include "unity.h"
+
+#include "debouncer.hpp"
+
+using Contacts = PedalWord<30>;
+
+static constexpr uint32_t settle_us = 5000;
+static constexpr uint32_t tick_us = 500;
+
+TEST_CASE("debouncer accepts a clean press at once", "[debouncer]")
+{
+    Debouncer<30> debouncer{settle_us, tick_us};
+    const Contacts pressed{1u << 7};
+    TEST_ASSERT_EQUAL_HEX32(1u << 7, debouncer.update(pressed, 100)[0]);
+    TEST_ASSERT_TRUE(debouncer.busy());
+}
+
+TEST_CASE("debouncer lockout lasts the settle time whatever the update times", "[debouncer]")
+{
+    // accepted anywhere between two ticks : locked for at least settle_us, at most one tick more
+    for (int64_t accept_us = 0; accept_us < 2 * tick_us; accept_us += 50){
+        Debouncer<30> debouncer{settle_us, tick_us};
+        const Contacts released{};
+        const Contacts pressed{1u};
+        debouncer.update(pressed, accept_us);
+        const int64_t unlock_us = debouncer.unlock_time_us();
+        TEST_ASSERT_GREATER_OR_EQUAL_INT64(accept_us + settle_us, unlock_us);
+        TEST_ASSERT_LESS_OR_EQUAL_INT64(accept_us + settle_us + tick_us, unlock_us);
+
+        // bounce ignored up to the unlock time, irregular updates (interrupt driven scan)
+        TEST_ASSERT_EQUAL_HEX32(1u, debouncer.update(released, accept_us + 1300)[0]);
+        TEST_ASSERT_EQUAL_HEX32(1u, debouncer.update(released, unlock_us - 1)[0]);
+        TEST_ASSERT_TRUE(debouncer.busy());
+        TEST_ASSERT_EQUAL_HEX32(0u, debouncer.update(released, unlock_us)[0]);
+        TEST_ASSERT_EQUAL_UINT32(1, debouncer.bounces(0));
+    }
+}
+
+TEST_CASE("debouncer unlock time is the end of the first running lockout", "[debouncer]")
+{
+    Debouncer<40> debouncer{settle_us, tick_us};
+    debouncer.update(PedalWord<40>{0, 1u << 3}, 1000);   // input 35
+    debouncer.update(PedalWord<40>{1u, 1u << 3}, 3000);  // input 0, 2 ms later
+    TEST_ASSERT_EQUAL_INT64(6500, debouncer.unlock_time_us());
+    debouncer.update(PedalWord<40>{1u, 1u << 3}, 6500);
+    TEST_ASSERT_TRUE(debouncer.busy());
+    TEST_ASSERT_EQUAL_INT64(8500, debouncer.unlock_time_us());
+    debouncer.update(PedalWord<40>{1u, 1u << 3}, 8500);
+    TEST_ASSERT_FALSE(debouncer.busy());
+}
+
+TEST_CASE("debouncer settle time limited by its lockout counters", "[debouncer]")
+{
+    // 4 planes : 15 ticks, one of them for the tick rounding
+    static_assert(Debouncer<30>::settle_fits(settle_us, tick_us));
+    static_assert(Debouncer<30>::settle_fits(7000, tick_us));
+    static_assert(!Debouncer<30>::settle_fits(10000, tick_us));
+    static_assert(Debouncer<30, 5>::settle_fits(10000, tick_us));
+    TEST_ASSERT_EQUAL_UINT32(settle_us + tick_us, (Debouncer<30>{settle_us, tick_us}.settle_us()));
+}
@@ -0,0 +1,154 @@
+#include <array>
+
+#include "unity.h"
+
+#include "i2c_master_bus.hpp"
+#include "i2c_master_sim.hpp"
+#include "mcp23017_model.hpp"
+#include "mcp23017_array.hpp"
+
+using Expanders = MCP23017::ExpanderArray<2>;
+
+// two MCP23017 models on sub addresses 0 and 1
+struct SimExpanders{
+    I2CSim::MCP23017Model chips[2];
+
+    SimExpanders()
+    {
+        I2CSim::attach(I2C_NUM_0, MCP23017::MCP23017_I2C_base_address, chips[0]);
+        I2CSim::attach(I2C_NUM_0, MCP23017::MCP23017_I2C_base_address + 1, chips[1]);
+        I2CSim::set_latency(0);
+        I2CSim::reset_stats(I2C_NUM_0);
+    }
+    ~SimExpanders()
+    {
+        I2CSim::detach(I2C_NUM_0, MCP23017::MCP23017_I2C_base_address);
+        I2CSim::detach(I2C_NUM_0, MCP23017::MCP23017_I2C_base_address + 1);
+    }
+};
+
+static void pedalboard_config(Expanders& expanders)
+{
+    expanders.set_config(
+        0xFF, 0xFF,  // inputs
+        0xFF, 0xFF,  // inverted polarity
+        0xFF, 0xFF); // pull-ups
+}
+
+TEST_CASE("expander array configuration and blocking scan", "[expanders]")
+{
+    SimExpanders sim;
+    I2CMaster::I2CBus bus{I2C_NUM_0, GPIO_NUM_9, GPIO_NUM_8, false};
+    Expanders expanders{bus, 100000UL, -1, true};
+    pedalboard_config(expanders);
+
+    for (auto& chip : sim.chips){
+        TEST_ASSERT_EQUAL_HEX8(0xFF, chip.reg(0x02));  // IPOLA
+        TEST_ASSERT_EQUAL_HEX8(0xFF, chip.reg(0x0D));  // GPPUB
+        TEST_ASSERT_EQUAL_HEX8(MCP23017::IOCON_MIRROR | MCP23017::IOCON_ODR, chip.reg(0x0A));
+        TEST_ASSERT_EQUAL_HEX8(0xFF, chip.reg(0x04));  // GPINTENA
+    }
+
+    // released pedals : pulled up, inverted -> 0
+    TEST_ASSERT_EQUAL_HEX32(0, expanders.scan()[0]);
+    // pedal 3 (chip 0) and pedal 16 + 9 (chip 1) pressed : inputs grounded
+    sim.chips[0].set_pins(static_cast<uint16_t>(~(1u << 3)));
+    sim.chips[1].set_pins(static_cast<uint16_t>(~(1u << 9)));
+    TEST_ASSERT_EQUAL_HEX32((1u << 3) | (1u << (16 + 9)), expanders.scan()[0]);
+    TEST_ASSERT_EQUAL_UINT32(2, expanders.scan_time().nb_scans);
+}
+
+TEST_CASE("expander array interrupt scan reads and clears the active chips only", "[expanders]")
+{
+    SimExpanders sim;
+    I2CMaster::I2CBus bus{I2C_NUM_0, GPIO_NUM_9, GPIO_NUM_8, false};
+    Expanders expanders{bus, 100000UL, -1, true};
+    pedalboard_config(expanders);
+    expanders.scan();
+
+    sim.chips[0].set_pins(static_cast<uint16_t>(~(1u << 3)));
+    TEST_ASSERT_FALSE(sim.chips[0].int_pin(0));  // INT active low
+    TEST_ASSERT_TRUE(sim.chips[1].int_pin(0));
+
+    I2CSim::reset_stats(I2C_NUM_0);
+    TEST_ASSERT_EQUAL_HEX32(1u << 3, expanders.scan_interrupts(0x1)[0]);
+    TEST_ASSERT_EQUAL_UINT32(1, I2CSim::stats(I2C_NUM_0).nb_transactions);
+    TEST_ASSERT_TRUE(sim.chips[0].int_pin(0));
+    TEST_ASSERT_EQUAL_HEX32(0x1, expanders.interrupts_read());
+    // pin 3 caused the interrupt, pressed state captured (IPOL applied to INTCAP)
+    TEST_ASSERT_EQUAL_HEX8(1u << 3, expanders.interrupt(0).flags[0]);
+    TEST_ASSERT_EQUAL_HEX8(1u << 3, expanders.interrupt(0).captures[0]);
+}
+
+TEST_CASE("expander array reconnects a chip after bus errors", "[expanders]")
+{
+    SimExpanders sim;
+    I2CMaster::I2CBus bus{I2C_NUM_0, GPIO_NUM_9, GPIO_NUM_8, false};
+    Expanders expanders{bus, 100000UL, -1, true};
+    pedalboard_config(expanders);
+    sim.chips[1].set_pins(static_cast<uint16_t>(~(1u << 9)));
+
+    // chip 1 unplugged for one read : its inputs read released
+    I2CSim::inject_nack(I2C_NUM_0, MCP23017::MCP23017_I2C_base_address + 1, 1);
+    TEST_ASSERT_EQUAL_HEX32(0, expanders.scan()[0]);
+    TEST_ASSERT(expanders.status(1) != MCP23017::Status_e::STS_READY);
+    TEST_ASSERT_EQUAL_UINT32(1, expanders.health(1).nb_errors);
+
+    // power cycled while unplugged : configuration written again on reconnection
+    sim.chips[1].reset();
+    sim.chips[1].set_pins(static_cast<uint16_t>(~(1u << 9)));
+    TEST_ASSERT_EQUAL_HEX32(1u << (16 + 9), expanders.scan()[0]);
+    TEST_ASSERT(expanders.status(1) == MCP23017::Status_e::STS_READY);
+    TEST_ASSERT_EQUAL_UINT32(1, expanders.health(1).nb_reconnects);
+    TEST_ASSERT_EQUAL_HEX8(MCP23017::IOCON_MIRROR | MCP23017::IOCON_ODR, sim.chips[1].reg(0x0A));
+}
+
+static int scans_done = 0;
+
+static bool on_scan_done(void* arg)
+{
+    scans_done++;
+    return false;
+}
+
+TEST_CASE("expander array asynchronous scan", "[expanders]")
+{
+    SimExpanders sim;
+    I2CMaster::I2CBus bus{I2C_NUM_0, GPIO_NUM_9, GPIO_NUM_8, false, I2C_CLK_SRC_DEFAULT, 7, 4};
+    Expanders expanders{bus};
+    pedalboard_config(expanders);
+    expanders.set_scan_done_callback(on_scan_done, NULL);
+    sim.chips[0].set_pins(static_cast<uint16_t>(~(1u << 3)));
+    sim.chips[1].set_pins(static_cast<uint16_t>(~(1u << 9)));
+
+    // simulated reads done before scan_async() returns : nothing to wait for, no callback
+    scans_done = 0;
+    TEST_ASSERT_FALSE(expanders.scan_async());
+    TEST_ASSERT_EQUAL_INT(0, scans_done);
+    TEST_ASSERT_EQUAL_HEX32((1u << 3) | (1u << (16 + 9)), expanders.scan_async_result()[0]);
+}
+
+TEST_CASE("expander array blocking writes kept apart from an asynchronous scan", "[expanders]")
+{
+    SimExpanders sim;
+    I2CMaster::I2CBus bus{I2C_NUM_0, GPIO_NUM_9, GPIO_NUM_8, false, I2C_CLK_SRC_DEFAULT, 7, 4};
+    Expanders expanders{bus};
+    pedalboard_config(expanders);
+    expanders.set_scan_done_callback(on_scan_done, NULL);
+
+    // chip 1 read NACKed, its failure not checked yet
+    I2CSim::inject_nack(I2C_NUM_0, MCP23017::MCP23017_I2C_base_address + 1, 1);
+    scans_done = 0;
+    TEST_ASSERT_FALSE(expanders.scan_async());
+
+    // blocking write : no scan done callback, the failed read not reported as its NACK
+    expanders.chip(1).set_config(0xFF, 0xFF, 0xFF, 0xFF, 0x0F, 0x0F);
+    TEST_ASSERT_EQUAL_INT(0, scans_done);
+    TEST_ASSERT(expanders.status(1) == MCP23017::Status_e::STS_READY);
+    TEST_ASSERT_EQUAL_HEX8(0x0F, sim.chips[1].reg(0x0C));  // GPPUA
+
+    // failed read reported by the scan result
+    expanders.scan_async_result();
+    TEST_ASSERT(expanders.status(1) != MCP23017::Status_e::STS_READY);
+    TEST_ASSERT_EQUAL_UINT32(1, expanders.health(1).nb_errors);
+}
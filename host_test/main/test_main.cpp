@@ -0,0 +1,12 @@
+#include <cstdlib>
+
+#include "unity.h"
+
+// every TEST_CASE of the test files, exit status for CI
+extern "C" void app_main(void)
+{
+    UNITY_BEGIN();
+    unity_run_all_tests();
+    const int failures = UNITY_END();
+    std::exit(failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,133 @@
+#include <array>
+#include <vector>
+
+#include "unity.h"
+
+#include "i2c_master_bus.hpp"
+#include "i2c_master_sim.hpp"
+#include "mcp23017_model.hpp"
+#include "mcp23017.hpp"
+
+// MCP23017 model recording the written registers : first register and length of each write
+struct RecordingModel : public I2CSim::MCP23017Model{
+    struct Write_t{
+        uint8_t reg;
+        std::size_t nb_regs;
+    };
+    std::vector<Write_t> writes;
+
+    bool on_write(std::span<const uint8_t> data) override
+    {
+        if (data.size() > 1){
+            writes.push_back({data[0], data.size() - 1});
+        }
+        return MCP23017Model::on_write(data);
+    }
+
+    // index of the last write covering reg, -1 if none
+    int written_at(uint8_t reg)
+    {
+        for (int w = writes.size() - 1; w >= 0; w--){
+            if (reg >= writes[w].reg && reg < writes[w].reg + writes[w].nb_regs){
+                return w;
+            }
+        }
+        return -1;
+    }
+};
+
+struct SimChip{
+    RecordingModel model;
+
+    SimChip()
+    {
+        I2CSim::attach(I2C_NUM_0, MCP23017::MCP23017_I2C_base_address, model);
+        I2CSim::set_latency(0);
+    }
+    ~SimChip()
+    {
+        I2CSim::detach(I2C_NUM_0, MCP23017::MCP23017_I2C_base_address);
+    }
+};
+
+TEST_CASE("mcp23017 configuration enables the interrupts last", "[mcp23017]")
+{
+    SimChip sim;
+    I2CMaster::I2CBus bus{I2C_NUM_0, GPIO_NUM_9, GPIO_NUM_8, false};
+    MCP23017::MCP23017 chip{bus, MCP23017::SubAddress_e::SUBADDR_0, 100000UL, -1, true};
+    chip.set_config(0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF);
+
+    // IOCON (open-drain INT), then the pins configuration, then GPINTEN
+    TEST_ASSERT_EQUAL_HEX8(0x0A, sim.model.writes[0].reg);
+    const int gppu = sim.model.written_at(0x0C);
+    const int gpinten = sim.model.written_at(0x04);
+    TEST_ASSERT_GREATER_THAN_INT(0, gppu);
+    TEST_ASSERT_GREATER_THAN_INT(gppu, gpinten);
+    TEST_ASSERT_EQUAL_UINT32(3, sim.model.writes.size());
+    TEST_ASSERT_EQUAL_HEX8(0xFF, sim.model.reg(0x04));
+    TEST_ASSERT_EQUAL_HEX8(0xFF, sim.model.reg(0x05));
+    TEST_ASSERT_EQUAL_HEX8(0xFF, sim.model.reg(0x0D));
+    TEST_ASSERT(chip.get_status() == MCP23017::Status_e::STS_READY);
+
+    // no interrupt raised while configuring (pins floating before the pull-ups)
+    TEST_ASSERT_TRUE(sim.model.int_pin(0));
+}
+
+TEST_CASE("mcp23017 reads dirty configuration registers from the chip", "[mcp23017]")
+{
+    SimChip sim;
+    I2CMaster::I2CBus bus{I2C_NUM_0, GPIO_NUM_9, GPIO_NUM_8, false};
+    MCP23017::MCP23017 chip{bus, MCP23017::SubAddress_e::SUBADDR_0};
+    chip.set_config(0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF);
+
+    // clean : read from the shadow, no bus transaction
+    I2CSim::reset_stats(I2C_NUM_0);
+    TEST_ASSERT_EQUAL_HEX8(0xFF, chip.read_register(MCP23017::Reg_e::REG_GPPUA));
+    TEST_ASSERT_EQUAL_UINT32(0, I2CSim::stats(I2C_NUM_0).nb_transactions);
+
+    // write failed : chip value unknown, read from the chip
+    I2CSim::inject_nack(I2C_NUM_0, MCP23017::MCP23017_I2C_base_address, 1);
+    chip.write_register(MCP23017::Reg_e::REG_GPPUA, 0x0F);
+    TEST_ASSERT_EQUAL_HEX8(0xFF, chip.read_register(MCP23017::Reg_e::REG_GPPUA));
+    TEST_ASSERT_EQUAL_UINT32(2, I2CSim::stats(I2C_NUM_0).nb_transactions);
+
+    // written again on reconnection, clean again
+    chip.check_status();
+    TEST_ASSERT(chip.get_status() == MCP23017::Status_e::STS_READY);
+    TEST_ASSERT_EQUAL_HEX8(0x0F, sim.model.reg(0x0C));
+    I2CSim::reset_stats(I2C_NUM_0);
+    TEST_ASSERT_EQUAL_HEX8(0x0F, chip.read_register(MCP23017::Reg_e::REG_GPPUA));
+    TEST_ASSERT_EQUAL_UINT32(0, I2CSim::stats(I2C_NUM_0).nb_transactions);
+}
+
+TEST_CASE("mcp23017 rejects blocks past the last register", "[mcp23017]")
+{
+    SimChip sim;
+    I2CMaster::I2CBus bus{I2C_NUM_0, GPIO_NUM_9, GPIO_NUM_8, false};
+    MCP23017::MCP23017 chip{bus, MCP23017::SubAddress_e::SUBADDR_0};
+    chip.set_config(0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF);
+
+    // OLATB (0x15) is the last register : 2 bytes from it do not fit, nothing sent
+    std::array<uint8_t, 2> values{0x12, 0x34};
+    I2CSim::reset_stats(I2C_NUM_0);
+    auto result = chip.try_write_block(MCP23017::Reg_e::REG_OLATB, values);
+    TEST_ASSERT_FALSE(result.has_value());
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_ARG, result.error());
+    result = chip.try_read_block(MCP23017::Reg_e::REG_OLATB, values);
+    TEST_ASSERT_FALSE(result.has_value());
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_ARG, result.error());
+    std::array<uint8_t, 4> pair_too_long{};
+    result = chip.try_read_registers_into(MCP23017::RegPair_e::REGS_OLAT, pair_too_long);
+    TEST_ASSERT_FALSE(result.has_value());
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_ARG, result.error());
+    std::array<uint8_t, MCP23017::MCP23017_nb_registers + 1> too_long{};
+    result = chip.try_write_block(MCP23017::Reg_e::REG_IODIRA, too_long);
+    TEST_ASSERT_FALSE(result.has_value());
+    TEST_ASSERT_EQUAL_UINT32(0, I2CSim::stats(I2C_NUM_0).nb_transactions);
+    // caller error : the chip is still connected
+    TEST_ASSERT(chip.get_status() == MCP23017::Status_e::STS_READY);
+
+    // a block ending on the last register fits
+    TEST_ASSERT_TRUE(chip.try_write_block(MCP23017::Reg_e::REG_OLATA, values).has_value());
+    TEST_ASSERT_EQUAL_HEX8(0x34, sim.model.reg(0x15));
+}
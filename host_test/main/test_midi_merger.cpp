@@ -0,0 +1,147 @@
+#include "unity.h"
+
+#include "midi_merger.hpp"
+
+using Merger = MidiMerger<8, 4, 50000>;
+
+static constexpr MidiEventPacket sysex_start{0x04, 0xF0, 0x43, 0x10};
+static constexpr MidiEventPacket sysex_continue{0x04, 0x01, 0x02, 0x03};
+static constexpr MidiEventPacket sysex_end{0x06, 0x04, 0xF7, 0x00};
+static constexpr MidiEventPacket note_on{0x09, 0x90, 0x3C, 0x40};
+static constexpr MidiEventPacket timing_clock{0x0F, 0xF8, 0x00, 0x00};
+
+static void push(Merger& merger, const MidiEventPacket& packet, bool local, int64_t now_us)
+{
+    TEST_ASSERT_TRUE(merger.push(midi_lane(packet, local), MidiOutEvent{packet, local ? 1u : 0u, now_us, now_us, 1}));
+}
+
+// packet popped, {0, 0, 0, 0} if none
+static MidiEventPacket pop(Merger& merger, int64_t now_us)
+{
+    MidiOutEvent event{};
+    merger.pop(event, now_us);
+    return event.packet;
+}
+
+TEST_CASE("merger lanes priority", "[merger]")
+{
+    Merger merger;
+    push(merger, MidiEventPacket{0x08, 0x80, 0x30, 0x00}, false, 0);
+    push(merger, note_on, true, 0);
+    push(merger, timing_clock, false, 0);
+    TEST_ASSERT(pop(merger, 10) == timing_clock);
+    TEST_ASSERT(pop(merger, 10) == note_on);
+    TEST_ASSERT(pop(merger, 10)[1] == 0x80);
+    TEST_ASSERT_FALSE(merger.ready(10));
+}
+
+TEST_CASE("merger holds other messages of the cable while a SysEx is open", "[merger]")
+{
+    Merger merger;
+    push(merger, sysex_start, false, 0);
+    TEST_ASSERT(pop(merger, 0) == sysex_start);
+
+    // SysEx lane empty (next IN transfer not received yet) : the pedal note waits
+    push(merger, note_on, true, 1000);
+    TEST_ASSERT_FALSE(merger.ready(1000));
+    TEST_ASSERT_TRUE(merger.holding());
+    MidiOutEvent event{};
+    TEST_ASSERT_FALSE(merger.pop(event, 1000));
+
+    // real time messages can still be inserted anywhere
+    push(merger, timing_clock, false, 2000);
+    TEST_ASSERT(pop(merger, 2000) == timing_clock);
+
+    // other cables are not held (lanes are FIFOs : pass through lane here)
+    const MidiEventPacket cable_1_note{0x19, 0x90, 0x40, 0x40};
+    push(merger, cable_1_note, false, 2000);
+    TEST_ASSERT(pop(merger, 2000) == cable_1_note);
+
+    push(merger, sysex_continue, false, 3000);
+    push(merger, sysex_end, false, 3000);
+    TEST_ASSERT(pop(merger, 3000) == sysex_continue);
+    TEST_ASSERT(pop(merger, 3000) == sysex_end);
+    TEST_ASSERT(pop(merger, 3000) == note_on);
+    TEST_ASSERT_FALSE(merger.holding());
+    TEST_ASSERT_EQUAL_UINT32(0, merger.sysex_timeouts());
+}
+
+TEST_CASE("merger ends a SysEx message after the hold timeout", "[merger]")
+{
+    Merger merger;
+    push(merger, sysex_start, false, 0);
+    TEST_ASSERT(pop(merger, 0) == sysex_start);
+    push(merger, note_on, true, 1000);
+    TEST_ASSERT_FALSE(merger.ready(49999));
+
+    // SysEx end sent on its cable, then the held note
+    TEST_ASSERT_TRUE(merger.ready(50000));
+    const MidiEventPacket eox{0x05, 0xF7, 0x00, 0x00};
+    TEST_ASSERT(pop(merger, 50000) == eox);
+    TEST_ASSERT(pop(merger, 50000) == note_on);
+    TEST_ASSERT_EQUAL_UINT32(1, merger.sysex_timeouts());
+
+    // late packets of the ended message dropped, a new message sent
+    push(merger, sysex_continue, false, 60000);
+    push(merger, sysex_end, false, 60000);
+    push(merger, sysex_start, false, 60000);
+    TEST_ASSERT(pop(merger, 60000) == sysex_start);
+    TEST_ASSERT_EQUAL_UINT32(2, merger.stats(MidiLane_e::SYSEX).nb_drops);
+}
+
+TEST_CASE("merger SysEx hold timed from the packets receive time", "[merger]")
+{
+    Merger merger;
+    push(merger, sysex_start, false, 0);
+    TEST_ASSERT(pop(merger, 0) == sysex_start);
+
+    // rest of the message received in time, OUT endpoint stalled : still sent after the hold
+    push(merger, sysex_continue, false, 10000);
+    push(merger, sysex_end, false, 10000);
+    push(merger, note_on, true, 10000);
+    TEST_ASSERT(pop(merger, 200000) == sysex_continue);
+    TEST_ASSERT(pop(merger, 200000) == sysex_end);
+    TEST_ASSERT(pop(merger, 200000) == note_on);
+    TEST_ASSERT_EQUAL_UINT32(0, merger.sysex_timeouts());
+    TEST_ASSERT_EQUAL_UINT32(0, merger.stats(MidiLane_e::SYSEX).nb_drops);
+
+    // start popped late : the hold runs from its receive time
+    push(merger, sysex_start, false, 300000);
+    TEST_ASSERT(pop(merger, 340000) == sysex_start);
+    push(merger, note_on, true, 340000);
+    TEST_ASSERT_FALSE(merger.ready(349999));
+    TEST_ASSERT_TRUE(merger.ready(350000));
+    TEST_ASSERT_EQUAL_UINT32(1, merger.sysex_timeouts());
+}
+
+TEST_CASE("merger sends a waiting SysEx before voice messages after MaxSysexWait transfers", "[merger]")
+{
+    Merger merger;
+    const MidiEventPacket voice{0x0B, 0xB0, 0x07, 0x64};
+    push(merger, sysex_start, false, 0);
+    for (uint32_t t = 0; t < 4; t++){
+        push(merger, voice, false, 0);
+        TEST_ASSERT(pop(merger, 0) == voice);
+        merger.end_transfer();
+    }
+    push(merger, voice, false, 0);
+    TEST_ASSERT(pop(merger, 0) == sysex_start);
+}
+
+TEST_CASE("merger idle only without queued packets or SysEx message in progress", "[merger]")
+{
+    Merger merger;
+    TEST_ASSERT_TRUE(merger.idle());
+    push(merger, note_on, true, 0);
+    TEST_ASSERT_FALSE(merger.idle());
+    TEST_ASSERT(pop(merger, 0) == note_on);
+    TEST_ASSERT_TRUE(merger.idle());
+
+    // open message, even with its lane empty
+    push(merger, sysex_start, false, 0);
+    TEST_ASSERT(pop(merger, 0) == sysex_start);
+    TEST_ASSERT_FALSE(merger.idle());
+    push(merger, sysex_end, false, 1000);
+    TEST_ASSERT(pop(merger, 1000) == sysex_end);
+    TEST_ASSERT_TRUE(merger.idle());
+}
@@ -0,0 +1,116 @@
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "unity.h"
+
+#include "midi_merger.hpp"
+#include "midi_router.hpp"
+
+// Pass through path of the USB task, without the USB stack : IN transfer routed in place
+// (midi_route_packets), packets queued in the merge lanes of the destination device, OUT
+// transfers filled up to the endpoint max packet size (pop_transfer)
+using Merger = MidiMerger<32, 4, 50000>;
+
+static constexpr std::size_t ep_mps = 64;
+static constexpr std::size_t out_max_events = 16;
+
+struct ThruResult{
+    uint32_t nb_in_packets;
+    uint32_t nb_routed;
+    uint32_t nb_out_packets;
+    uint32_t nb_out_transfers;
+    uint32_t nb_sequence_errors;  // voice packets out of order
+};
+
+// IN transfers of a busy MIDI stream : note on / off with a sequence number, one timing
+// clock (filtered out) and a short SysEx message in every transfer
+static std::vector<std::array<uint8_t, ep_mps>> thru_stream(std::size_t nb_transfers)
+{
+    std::vector<std::array<uint8_t, ep_mps>> transfers(nb_transfers);
+    uint32_t seq = 0;
+    for (auto& in : transfers){
+        std::size_t p = 0;
+        auto put = [&](const MidiEventPacket& packet){std::copy(packet.begin(), packet.end(), in.begin() + 4 * p++);};
+        put({0x0F, 0xF8, 0x00, 0x00});
+        put({0x04, 0xF0, 0x43, 0x10});
+        put({0x06, 0x4C, 0xF7, 0x00});
+        while (p < ep_mps / 4){
+            put({0x09, 0x91, static_cast<uint8_t>(seq & 0x7F), static_cast<uint8_t>((seq >> 7) & 0x7F)});
+            seq++;
+        }
+    }
+    return transfers;
+}
+
+static ThruResult thru_run(const std::vector<std::array<uint8_t, ep_mps>>& stream)
+{
+    MidiRouter router = MidiRouter::forward_all();
+    router.drop_system_msg = MIDI_SYSTEM_CLOCK | MIDI_SYSTEM_ACTIVE_SENSING;
+    Merger merger;
+    ThruResult result{};
+    uint32_t next_seq = 0;
+    std::array<uint8_t, ep_mps> out;
+
+    auto send_pending = [&](int64_t now_us){
+        while (merger.ready(now_us)){
+            const std::size_t nb_bytes = merger.pop_transfer(out, out_max_events, now_us, [&](const MidiOutEvent& event){
+                if (event.packet[1] == 0x91){
+                    const uint32_t seq = event.packet[2] | (uint32_t{event.packet[3]} << 7);
+                    result.nb_sequence_errors += (seq != (next_seq & 0x3FFF));
+                    next_seq = seq + 1;
+                }
+            });
+            result.nb_out_packets += nb_bytes / 4;
+            result.nb_out_transfers++;
+        }
+    };
+
+    int64_t now_us = 0;
+    for (const auto& received : stream){
+        std::array<uint8_t, ep_mps> in = received;
+        const MidiRouteResult routed = midi_route_packets(router, in, in);
+        result.nb_in_packets += in.size() / 4;
+        result.nb_routed += routed.nb_written / 4;
+        const MidiPacketReader packets{std::span<const uint8_t>{in.data(), routed.nb_written}};
+        for (std::size_t p = 0; p < packets.size(); p++){
+            const MidiOutEvent event{packets[p], 0, 0, now_us, 1};
+            const MidiLane_e lane = midi_lane(event.packet, false);
+            if (!merger.push(lane, event)){
+                send_pending(now_us);
+                merger.push(lane, event);
+            }
+        }
+        send_pending(now_us);
+        now_us += 125;
+    }
+    return result;
+}
+
+TEST_CASE("pass through routes and batches every packet in order", "[thru]")
+{
+    const ThruResult result = thru_run(thru_stream(100));
+    TEST_ASSERT_EQUAL_UINT32(1600, result.nb_in_packets);
+    TEST_ASSERT_EQUAL_UINT32(1500, result.nb_routed);  // timing clocks filtered out
+    TEST_ASSERT_EQUAL_UINT32(result.nb_routed, result.nb_out_packets);
+    TEST_ASSERT_EQUAL_UINT32(0, result.nb_sequence_errors);
+    // 15 packets per IN transfer : one OUT transfer each
+    TEST_ASSERT_EQUAL_UINT32(100, result.nb_out_transfers);
+}
+
+TEST_CASE("pass through throughput", "[thru][bench]")
+{
+    constexpr std::size_t nb_transfers = 20000;
+    const auto stream = thru_stream(nb_transfers);
+    using Clock = std::chrono::steady_clock;
+    const auto t0 = Clock::now();
+    const ThruResult result = thru_run(stream);
+    const auto t1 = Clock::now();
+
+    TEST_ASSERT_EQUAL_UINT32(result.nb_routed, result.nb_out_packets);
+    TEST_ASSERT_EQUAL_UINT32(0, result.nb_sequence_errors);
+    const double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+    printf("pass through : %lu IN packets -> %lu OUT packets in %lu transfers, %.1f ns/packet, %.2f Mpackets/s\n",
+        static_cast<unsigned long>(result.nb_in_packets), static_cast<unsigned long>(result.nb_out_packets),
+        static_cast<unsigned long>(result.nb_out_transfers), ns / result.nb_in_packets, 1000.0 * result.nb_in_packets / ns);
+}
@@ -0,0 +1,93 @@
+#include <cstdlib>
+#include <random>
+
+#include "unity.h"
+
+#include "pedal_velocity.hpp"
+
+static constexpr VelocityCurve curve = make_velocity_curve(2000, 40000, VelocityShape_e::LINEAR);
+
+TEST_CASE("velocity curve from the loudest to the softest press", "[velocity]")
+{
+    TEST_ASSERT_EQUAL_UINT8(127, curve.velocity(0));
+    TEST_ASSERT_EQUAL_UINT8(127, curve.velocity(2000));
+    TEST_ASSERT_EQUAL_UINT8(1, curve.velocity(40000));
+    TEST_ASSERT_EQUAL_UINT8(1, curve.velocity(1000000));
+    for (int64_t delay_us = 2000; delay_us < 40000; delay_us += 100){
+        TEST_ASSERT_TRUE(curve.velocity(delay_us + 100) <= curve.velocity(delay_us));
+    }
+}
+
+TEST_CASE("dual contact pedal notes", "[velocity]")
+{
+    DualContactPedals<32> pedals{curve, 64};
+    int nb_notes = 0;
+    PedalNote last{};
+    auto on_note = [&](const PedalNote& note){nb_notes++; last = note;};
+
+    // press stopped before the late contact : nothing played
+    pedals.contact(3, false, true, 1000, on_note);
+    pedals.contact(3, false, false, 9000, on_note);
+    TEST_ASSERT_EQUAL_INT(0, nb_notes);
+
+    // full press : note on at the late make, note off at the late break
+    pedals.contact(3, false, true, 10000, on_note);
+    pedals.contact(3, true, true, 12000, on_note);
+    TEST_ASSERT_EQUAL_INT(1, nb_notes);
+    TEST_ASSERT_TRUE(last.note_on);
+    TEST_ASSERT_EQUAL_UINT8(127, last.velocity);
+    TEST_ASSERT_EQUAL_HEX32(1u << 3, pedals.state()[0]);
+    pedals.contact(3, true, false, 50000, on_note);
+    TEST_ASSERT_EQUAL_INT(2, nb_notes);
+    TEST_ASSERT_FALSE(last.note_on);
+    pedals.contact(3, false, false, 51000, on_note);
+
+    // early contact faulty : default velocity, counted
+    pedals.contact(5, true, true, 60000, on_note);
+    TEST_ASSERT_EQUAL_UINT8(64, last.velocity);
+    TEST_ASSERT_EQUAL_UINT32(1, pedals.missed_early());
+}
+
+// Simulated edge stream, time stamps given as the scan loop does (contacts_edge_times()) :
+// the early make raises INT and is stamped at the INT edge, the late make is stamped at its
+// own INT edge, or at the registers read time if it happens before the interrupt is cleared.
+// Returns the presses given the exact velocity of their contacts delay.
+static uint32_t edge_stream_exact(uint32_t nb_presses, int64_t read_us, uint32_t& nb_stamped_at_read)
+{
+    constexpr int64_t wake_us = 50;  // INT edge -> scan task running
+    DualContactPedals<1> pedals{curve, 64};
+    std::mt19937 rng{1};
+    std::uniform_int_distribution<int64_t> contacts_delay_us{1000, 45000};
+    uint32_t nb_exact = 0;
+    nb_stamped_at_read = 0;
+    for (uint32_t p = 0; p < nb_presses; p++){
+        const int64_t early_us = 1000000 + int64_t{p} * 100000;
+        const int64_t delay_us = contacts_delay_us(rng);
+        const int64_t late_us = early_us + delay_us;
+        const int64_t cleared_us = early_us + wake_us + read_us;
+        int64_t late_stamp_us = late_us;
+        if (late_us < cleared_us){
+            late_stamp_us = cleared_us;
+            nb_stamped_at_read++;
+        }
+        uint8_t velocity = 0;
+        pedals.contact(0, false, true, early_us, [](const PedalNote&){});
+        pedals.contact(0, true, true, late_stamp_us, [&](const PedalNote& note){velocity = note.velocity;});
+        pedals.contact(0, true, false, late_us + 30000, [](const PedalNote&){});
+        pedals.contact(0, false, false, late_us + 31000, [](const PedalNote&){});
+        if (velocity == curve.velocity(delay_us)){
+            nb_exact++;
+        }
+    }
+    return nb_exact;
+}
+
+TEST_CASE("dual contact velocity exact on a simulated edge stream", "[velocity]")
+{
+    // registers read within 1.6 ms (2 expanders at 100 kHz) : every late edge after the
+    // interrupt is cleared (curve minimum 2 ms), every velocity exact
+    uint32_t nb_stamped_at_read = 0;
+    TEST_ASSERT_EQUAL_UINT32(10000, edge_stream_exact(10000, 1600, nb_stamped_at_read));
+    // faster presses than the curve minimum are stamped at the read time : still 127
+    TEST_ASSERT_GREATER_THAN_UINT32(0, nb_stamped_at_read);
+}
@@ -0,0 +1,135 @@
+#include <bitset>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "unity.h"
+
+#include "pedal_word.hpp"
+
+// Former scan loop representation : std::bitset filled byte by byte (operator<<,
+// last expander port first), every input tested for the note on / off masks
+template<std::size_t N>
+static std::bitset<N>& operator<<(std::bitset<N>& bits, const uint8_t byte)
+{
+    bits <<= 8;
+    bits |= std::bitset<N>(byte);
+    return bits;
+}
+
+template<std::size_t N>
+struct ScanStream{
+    static constexpr std::size_t NbBytes = (N + 7) / 8;
+    std::vector<std::array<uint8_t, NbBytes>> scans;  // ports read, 2 pedals changed per scan
+
+    explicit ScanStream(std::size_t nb_scans): scans(nb_scans)
+    {
+        std::mt19937 rng{1};
+        std::array<uint8_t, NbBytes> ports{};
+        for (auto& scan : scans){
+            for (int k = 0; k < 2; k++){
+                const std::size_t b = rng() % N;
+                ports[b / 8] ^= 1u << (b % 8);
+            }
+            scan = ports;
+        }
+    }
+};
+
+// sum of (input + 1) of the released inputs, and of (input + 1) * N of the pressed ones
+template<std::size_t N>
+static uint64_t bitset_scans(const ScanStream<N>& stream)
+{
+    uint64_t sum = 0;
+    std::bitset<N> status{};
+    for (const auto& ports : stream.scans){
+        const std::bitset<N> prec = status;
+        for (std::size_t i = ports.size(); i-- > 0;){
+            status << ports[i];
+        }
+        if (status != prec){
+            const std::bitset<N> note_off = prec & ~status;
+            const std::bitset<N> note_on = ~prec & status;
+            for (std::size_t b = 0; b < N; b++){
+                if (note_off.test(b)){
+                    sum += b + 1;
+                }
+            }
+            for (std::size_t b = 0; b < N; b++){
+                if (note_on.test(b)){
+                    sum += (b + 1) * N;
+                }
+            }
+        }
+    }
+    return sum;
+}
+
+template<std::size_t N>
+static uint64_t pedal_word_scans(const ScanStream<N>& stream)
+{
+    uint64_t sum = 0;
+    PedalWord<N> status{};
+    for (const auto& ports : stream.scans){
+        const PedalWord<N> prec = status;
+        for (std::size_t i = 0; i < ports.size(); i++){
+            pedal_word_set_byte<N>(status, i, ports[i]);
+        }
+        pedal_word_mask_unused<N>(status);
+        const PedalEdges<N> edges = pedal_edges<N>(prec, status);
+        if (edges.any){
+            for_each_set_bit(edges.released, [&](std::size_t b){sum += b + 1;});
+            for_each_set_bit(edges.pressed, [&](std::size_t b){sum += (b + 1) * N;});
+        }
+    }
+    return sum;
+}
+
+// ns per scan of both representations, same edges found
+template<std::size_t N>
+static void pedal_word_bench(void)
+{
+    constexpr std::size_t nb_scans = 100000;
+    const ScanStream<N> stream{nb_scans};
+    using Clock = std::chrono::steady_clock;
+
+    const auto t0 = Clock::now();
+    const uint64_t bitset_sum = bitset_scans<N>(stream);
+    const auto t1 = Clock::now();
+    const uint64_t pedal_word_sum = pedal_word_scans<N>(stream);
+    const auto t2 = Clock::now();
+
+    TEST_ASSERT_EQUAL_UINT64(bitset_sum, pedal_word_sum);
+    printf("%3zu inputs : bitset %6.1f ns/scan, pedal word %6.1f ns/scan\n", N,
+        std::chrono::duration<double, std::nano>(t1 - t0).count() / nb_scans,
+        std::chrono::duration<double, std::nano>(t2 - t1).count() / nb_scans);
+}
+
+TEST_CASE("pedal word edges", "[pedal_word]")
+{
+    PedalWord<40> prec{};
+    PedalWord<40> state{};
+    pedal_word_set_byte<40>(prec, 0, 0x81);
+    pedal_word_set_byte<40>(state, 0, 0x01);
+    pedal_word_set_byte<40>(state, 4, 0xFF);
+    pedal_word_mask_unused<40>(state);
+    TEST_ASSERT_EQUAL_HEX32(0xFF, state[1]);
+
+    const PedalEdges<40> edges = pedal_edges<40>(prec, state);
+    TEST_ASSERT_TRUE(edges.any);
+    TEST_ASSERT_EQUAL_HEX32(0x80, edges.released[0]);
+    TEST_ASSERT_EQUAL_HEX32(0xFF, edges.pressed[1]);
+    std::vector<std::size_t> pressed;
+    for_each_set_bit(edges.pressed, [&](std::size_t b){pressed.push_back(b);});
+    TEST_ASSERT_EQUAL_UINT32(8, pressed.size());
+    TEST_ASSERT_EQUAL_UINT32(32, pressed.front());
+    TEST_ASSERT_EQUAL_UINT32(39, pressed.back());
+}
+
+TEST_CASE("pedal word vs bitset scan benchmark", "[pedal_word][bench]")
+{
+    pedal_word_bench<30>();
+    pedal_word_bench<64>();
+    pedal_word_bench<128>();
+}
@@ -0,0 +1,78 @@
+#include <cstdlib>
+#include <new>
+
+#include "unity.h"
+
+#include "i2c_master_bus.hpp"
+#include "i2c_master_sim.hpp"
+#include "mcp23017_model.hpp"
+#include "mcp23017_array.hpp"
+#include "debouncer.hpp"
+
+// global operator new counting the allocations while enabled (test binary only)
+static bool alloc_counting = false;
+static uint32_t alloc_count = 0;
+
+void* operator new(std::size_t size)
+{
+    if (alloc_counting){
+        alloc_count++;
+    }
+    void* p = std::malloc(size ? size : 1);
+    if (p == NULL){
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {std::free(p);}
+void operator delete(void* p, std::size_t) noexcept {std::free(p);}
+
+template<typename F>
+static uint32_t allocations(F&& f)
+{
+    alloc_count = 0;
+    alloc_counting = true;
+    f();
+    alloc_counting = false;
+    return alloc_count;
+}
+
+TEST_CASE("scan path does not allocate", "[scan][heap]")
+{
+    I2CSim::MCP23017Model chips[2];
+    I2CSim::attach(I2C_NUM_0, MCP23017::MCP23017_I2C_base_address, chips[0]);
+    I2CSim::attach(I2C_NUM_0, MCP23017::MCP23017_I2C_base_address + 1, chips[1]);
+    I2CSim::set_latency(0);
+    {
+        I2CMaster::I2CBus bus{I2C_NUM_0, GPIO_NUM_9, GPIO_NUM_8, false};
+        MCP23017::ExpanderArray<2> expanders{bus, 100000UL, -1, true};
+        expanders.set_config(0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF);
+        Debouncer<30> debouncer{5000, 500};
+        PedalWord<30> status{};
+
+        // counter check : the legacy vector API allocates
+        MCP23017::MCP23017 chip{bus, MCP23017::SubAddress_e::SUBADDR_0};
+        TEST_ASSERT_GREATER_THAN_UINT32(0, allocations([&](){chip.read_ports();}));
+
+        // span API : blocking and interrupt scans, debounce, edges
+        int64_t now_us = 0;
+        const uint32_t nb = allocations([&](){
+            for (uint32_t s = 0; s < 1000; s++){
+                chips[s & 1].set_pins(static_cast<uint16_t>(~(1u << (s % 16))));
+                PedalWord<30> raw{};
+                raw[0] = ((s & 2) ? expanders.scan_interrupts(0x3) : expanders.scan())[0] & 0x3FFFFFFF;
+                const PedalWord<30> prec = status;
+                status = debouncer.update(raw, now_us);
+                const PedalEdges<30> edges = pedal_edges<30>(prec, status);
+                for_each_set_bit(edges.pressed, [&](std::size_t b){now_us += b;});
+                now_us += 1000;
+                std::array<uint8_t, 2> ports;
+                chip.read_ports_into(ports);
+            }
+        });
+        TEST_ASSERT_EQUAL_UINT32(0, nb);
+    }
+    I2CSim::detach(I2C_NUM_0, MCP23017::MCP23017_I2C_base_address);
+    I2CSim::detach(I2C_NUM_0, MCP23017::MCP23017_I2C_base_address + 1);
+}
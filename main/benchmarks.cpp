@@ -0,0 +1,135 @@
+#include <array>
+#include <atomic>
+
+#include "sdkconfig.h"
+#include "esp_heap_trace.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "benchmarks.hpp"
+
+static const char TAG[] = "pedalboard:bench";
+
+#define BENCH_TIMEOUT_US 1000000
+
+// last event completed (tokens increase), and its OUT transfer done time
+static std::atomic<uint32_t> bench_done_token{0};
+static std::atomic<int64_t> bench_done_us{0};
+
+// USB task
+static void bench_out_done(const MidiOutCompletion& completion, void *arg)
+{
+    if ((completion.last_token != 0) && (completion.status == USB_TRANSFER_STATUS_COMPLETED)){
+        bench_done_us.store(completion.timestamp_us, std::memory_order_relaxed);
+        bench_done_token.store(completion.last_token, std::memory_order_release);
+    }
+}
+
+// time from start_us to the OUT transfer done of the token event, -1 on timeout
+static int64_t bench_wait(uint32_t token, int64_t start_us)
+{
+    while (bench_done_token.load(std::memory_order_acquire) < token){
+        if (esp_timer_get_time() - start_us > BENCH_TIMEOUT_US){
+            return -1;
+        }
+        vTaskDelay(1);
+    }
+    return bench_done_us.load(std::memory_order_relaxed) - start_us;
+}
+
+// events of the pedals queued, returns the last token (0 : none queued)
+static uint32_t bench_send(UsbHostMidiClient& usb_midi, std::span<const MidiEventPacket> packets, uint8_t devices, uint32_t& nb_packets)
+{
+    uint32_t token = 0;
+    for (const MidiEventPacket& packet : packets){
+        const uint32_t t = usb_midi.send_async(packet, 0, devices);
+        if (t != 0){
+            token = t;
+            nb_packets++;
+        }
+    }
+    return token;
+}
+
+static GlissandoResult glissando_run(UsbHostMidiClient& usb_midi, std::size_t nb_pedals, PedalEventsFn events, uint8_t devices, bool batched)
+{
+    GlissandoResult result{0, 0, -1};
+    // same events, flush and transfers pool : only the packets per transfer differ
+    usb_midi.set_out_batch_limit(batched ? MIDI_OUT_XFER_MAX_EVENTS : events(0, true).size());
+    const uint32_t transfers = usb_midi.out_transfers();
+    const int64_t start_us = esp_timer_get_time();
+    uint32_t token = 0;
+    for (std::size_t p = 0; p < nb_pedals; p++){
+        token = bench_send(usb_midi, events(p, true), devices, result.nb_packets);
+    }
+    usb_midi.flush();
+    result.time_us = bench_wait(token, start_us);
+    result.nb_transfers = usb_midi.out_transfers() - transfers;
+
+    // notes ended, not measured
+    uint32_t nb_packets = 0;
+    for (std::size_t p = 0; p < nb_pedals; p++){
+        token = bench_send(usb_midi, events(p, false), devices, nb_packets);
+    }
+    usb_midi.flush();
+    bench_wait(token, esp_timer_get_time());
+    usb_midi.set_out_batch_limit(MIDI_OUT_XFER_MAX_EVENTS);
+    return result;
+}
+
+#if CONFIG_PDB_BENCH_SCAN_HEAP
+#define SCAN_HEAP_TRACE_RECORDS 16
+static heap_trace_record_t scan_heap_records[SCAN_HEAP_TRACE_RECORDS];
+
+void scan_heap_bench(uint32_t nb_scans, ScanFn scan, void *arg, std::span<const char* const> other_tasks)
+{
+    std::array<TaskHandle_t, 8> suspended{};
+    std::size_t nb_suspended = 0;
+    for (const char *name : other_tasks){
+        const TaskHandle_t hdl = xTaskGetHandle(name);
+        if ((hdl != NULL) && (nb_suspended < suspended.size())){
+            vTaskSuspend(hdl);
+            suspended[nb_suspended++] = hdl;
+        }
+    }
+
+    ESP_ERROR_CHECK(heap_trace_init_standalone(scan_heap_records, SCAN_HEAP_TRACE_RECORDS));
+    ESP_ERROR_CHECK(heap_trace_start(HEAP_TRACE_ALL));
+    for (uint32_t s = 0; s < nb_scans; s++){
+        scan(arg);
+    }
+    ESP_ERROR_CHECK(heap_trace_stop());
+
+    for (std::size_t t = 0; t < nb_suspended; t++){
+        vTaskResume(suspended[t]);
+    }
+
+    const std::size_t nb_allocations = heap_trace_get_count();
+    if (nb_allocations == 0){
+        ESP_LOGI(TAG, "scan path : %lu scans, no heap allocation", static_cast<unsigned long>(nb_scans));
+    } else {
+        ESP_LOGE(TAG, "scan path : %u heap allocation(s) in %lu scans", static_cast<unsigned>(nb_allocations), static_cast<unsigned long>(nb_scans));
+        heap_trace_dump();
+    }
+}
+#endif
+
+void glissando_bench(UsbHostMidiClient& usb_midi, std::size_t nb_pedals, PedalEventsFn events, uint8_t devices)
+{
+    usb_midi.set_out_done_callback(bench_out_done, NULL);
+    const GlissandoResult single = glissando_run(usb_midi, nb_pedals, events, devices, false);
+    vTaskDelay(pdMS_TO_TICKS(100));
+    const GlissandoResult batched = glissando_run(usb_midi, nb_pedals, events, devices, true);
+    usb_midi.set_out_done_callback(NULL, NULL);
+
+    ESP_LOGI(TAG, "glissando %u pedals : transfer per pedal %lu packets / %lu transfers / %lld us, batched %lu packets / %lu transfers / %lld us",
+        static_cast<unsigned>(nb_pedals),
+        static_cast<unsigned long>(single.nb_packets), static_cast<unsigned long>(single.nb_transfers), static_cast<long long>(single.time_us),
+        static_cast<unsigned long>(batched.nb_packets), static_cast<unsigned long>(batched.nb_transfers), static_cast<long long>(batched.time_us));
+    if ((single.time_us >= 0) && (batched.time_us >= 0)){
+        ESP_LOGI(TAG, "glissando %u pedals : %lu transfers and %lld us saved by batching", static_cast<unsigned>(nb_pedals),
+            static_cast<unsigned long>(single.nb_transfers - batched.nb_transfers), static_cast<long long>(single.time_us - batched.time_us));
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "usb_midi.hpp"
+
+// On-target benchmarks (menuconfig "MIDI pedalboard benchmarks"), run by the scan task :
+// scan path before the scan loop, MIDI ones once a MIDI device is connected (the notes
+// played are ended). Results logged.
+
+// events of one pedal change (pedal MIDI map)
+using PedalEventsFn = std::span<const MidiEventPacket> (*)(std::size_t pedal, bool note_on);
+
+struct GlissandoResult{
+    uint32_t nb_packets;
+    uint32_t nb_transfers;  // OUT transfers submitted meanwhile (pass through included)
+    int64_t time_us;        // first event queued -> last event OUT transfer done (-1 : timeout)
+};
+
+// one scan pass of the scan loop (arg : its state)
+using ScanFn = void (*)(void *arg);
+
+// nb_scans scans under heap tracing (HEAP_TRACING_STANDALONE) : allocations logged, 0 expected.
+// The other pedalboard tasks are suspended meanwhile, so that only the scan path is traced
+void scan_heap_bench(uint32_t nb_scans, ScanFn scan, void *arg, std::span<const char* const> other_tasks);
+
+// every pedal pressed in the same scan, twice : one OUT transfer per pedal (the unbatched
+// path), then transfers filled up to the endpoint max packet size. Both runs queue the
+// events in one flush, their transfers submitted back to back from the same pool
+void glissando_bench(UsbHostMidiClient& usb_midi, std::size_t nb_pedals, PedalEventsFn events, uint8_t devices);
@@ -0,0 +1,61 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <utility>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "boot_timeline.hpp"
+
+static const char TAG[] = "pedalboard:boot";
+
+// 0 : step not reached yet
+static std::array<std::atomic<int64_t>, std::to_underlying(BootStep_e::NB_STEPS)> boot_steps_us;
+
+static const char *const boot_step_names[] = {
+    "app_main",
+    "USB host installed",
+    "expanders configured",
+    "scan started",
+    "first scan",
+    "USB device opened",
+    "USB MIDI ready",
+    "MIDI config sent",
+};
+static_assert(sizeof(boot_step_names) / sizeof(boot_step_names[0]) == std::to_underlying(BootStep_e::NB_STEPS));
+
+void boot_mark(BootStep_e step)
+{
+    int64_t unset = 0;
+    boot_steps_us[std::to_underlying(step)].compare_exchange_strong(unset, std::max<int64_t>(esp_timer_get_time(), 1));
+}
+
+bool boot_complete(void)
+{
+    return std::all_of(boot_steps_us.begin(), boot_steps_us.end(), [](const std::atomic<int64_t>& t){return t.load() != 0;});
+}
+
+void boot_timeline_dump(void)
+{
+    std::array<std::size_t, std::to_underlying(BootStep_e::NB_STEPS)> order;
+    std::array<int64_t, std::to_underlying(BootStep_e::NB_STEPS)> times_us;
+    for (std::size_t s = 0; s < order.size(); s++){
+        order[s] = s;
+        times_us[s] = boot_steps_us[s].load();
+    }
+    std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b){
+        // steps not reached last
+        return (times_us[a] != 0) && ((times_us[b] == 0) || (times_us[a] < times_us[b]));
+    });
+    int64_t prec_us = 0;
+    for (const std::size_t s : order){
+        if (times_us[s] == 0){
+            ESP_LOGI(TAG, "%-22s : not reached", boot_step_names[s]);
+            continue;
+        }
+        ESP_LOGI(TAG, "%-22s : %8lld us (+%lld us)", boot_step_names[s], static_cast<long long>(times_us[s]),
+            static_cast<long long>(times_us[s] - prec_us));
+        prec_us = times_us[s];
+    }
+}
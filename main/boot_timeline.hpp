@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+// Boot steps, in their usual order (USB and pedals steps run in parallel)
+enum class BootStep_e : uint8_t
+{
+    APP_MAIN,              // app_main entry (esp_timer time 0 : app start, after the bootloader)
+    USB_HOST_INSTALLED,    // USB host library and MIDI client tasks started
+    EXPANDERS_CONFIGURED,  // MCP23017 registers written
+    SCAN_STARTED,          // scan loop entered
+    FIRST_SCAN,            // first pedals state read
+    USB_DEVICE_OPENED,     // first device enumerated and opened
+    USB_MIDI_READY,        // first MIDI Streaming interface claimed, IN armed
+    MIDI_CONFIG_SENT,      // pedal notes can be sent
+    NB_STEPS
+};
+
+// timestamp of the first occurrence of a step, from any task (later ones ignored)
+void boot_mark(BootStep_e step);
+// every step reached
+bool boot_complete(void);
+// steps reached, in time order, with their delay from the previous one
+void boot_timeline_dump(void);
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include "pedal_word.hpp"
+
+// Bit-parallel pedals debounce (lockout).
+// A change of a stable input is accepted at once (no added latency for a clean press),
+// then the input is locked for the settle time and its contact bounces are ignored.
+// Lockout counters are vertical (bit-sliced) down counters : plane p holds bit p of the
+// counters of 32 inputs, so the cost does not depend on the number of inputs.
+// The lockout is counted in ticks of the debouncer own time base (µs time stamps of the
+// updates), independent of the scan rate : updates may come at any time (interrupt driven scan).
+template<std::size_t NbInputs, std::size_t NbPlanes = 4>
+class Debouncer{
+
+public:
+
+    static constexpr std::size_t NbWords = (NbInputs + 31) / 32;
+    using Word = PedalWord<NbInputs>;
+    static constexpr uint32_t max_settle_ticks = (1u << NbPlanes) - 1;
+
+    // the lockout fits in the counters : settle_us / tick_us (rounded up) + 1 <= 2^NbPlanes - 1
+    static constexpr bool settle_fits(uint32_t settle_us, uint32_t tick_us){
+        return (tick_us > 0) && ((settle_us + tick_us - 1) / tick_us + 1 <= max_settle_ticks);
+    }
+
+    // settle_us : lockout time, tick_us : lockout resolution (settle_fits(), checked by
+    // static_assert for constant settings : a longer lockout would be cut short)
+    Debouncer(uint32_t settle_us, uint32_t tick_us, int64_t now_us = 0):
+    tick{tick_us},
+    settle{settle_ticks(settle_us)},
+    tick_time_us{now_us},
+    planes{},
+    debounced{},
+    raw_prec{},
+    bounce_counts{}
+    {}
+
+    // now_us : time of the raw inputs read
+    const Word& update(const Word& raw, int64_t now_us){
+        const int64_t nb_ticks = std::max<int64_t>(now_us - tick_time_us, 0) / tick;
+        tick_time_us += nb_ticks * tick;
+        for (std::size_t w = 0; w < NbWords; w++){
+            uint32_t locked = countdown(w, std::min<int64_t>(nb_ticks, max_settle_ticks));
+
+            // changes of unlocked inputs are accepted
+            const uint32_t accepted = (raw[w] ^ debounced[w]) & ~locked;
+            debounced[w] ^= accepted;
+            // accepted inputs locked for the settle time
+            for (std::size_t p = 0; p < NbPlanes; p++){
+                planes[p][w] = (planes[p][w] & ~accepted) | (((settle >> p) & 1) ? accepted : 0);
+            }
+
+            // bounce statistics : raw changes of locked inputs (only the bouncing bits are visited)
+            uint32_t bouncing = (raw[w] ^ raw_prec[w]) & locked;
+            while (bouncing){
+                bounce_counts[w * 32 + std::countr_zero(bouncing)]++;
+                bouncing &= bouncing - 1;
+            }
+            raw_prec[w] = raw[w];
+        }
+        return debounced;
+    }
+
+    const Word& state(void) const {return debounced;}
+
+    // some inputs are still locked : update() needed later even without raw change
+    bool busy(void) const {
+        uint32_t locked = 0;
+        for (const auto& plane : planes){
+            for (const uint32_t bits : plane){
+                locked |= bits;
+            }
+        }
+        return locked != 0;
+    }
+
+    // end of the first lockout still running (time of the update that unlocks it), valid if busy()
+    int64_t unlock_time_us(void) const {
+        uint32_t ticks = max_settle_ticks;
+        for (std::size_t w = 0; w < NbWords; w++){
+            const uint32_t locked = lock_mask(w);
+            if (locked){
+                ticks = std::min(ticks, min_counter(w, locked));
+            }
+        }
+        return tick_time_us + static_cast<int64_t>(ticks) * tick;
+    }
+
+    void set_settle_us(uint32_t settle_us) {settle = settle_ticks(settle_us);}
+    uint32_t settle_us(void) const {return settle * tick;}
+
+    // per input bounce statistics, since the last reset_stats()
+    uint32_t bounces(std::size_t input) const {return bounce_counts[input];}
+    void reset_stats(void) {bounce_counts.fill(0);}
+
+private:
+    uint32_t tick;
+    uint32_t settle;      // in ticks
+    int64_t tick_time_us; // last tick
+    std::array<Word, NbPlanes> planes;  // lockout counters, bit-sliced
+    Word debounced;
+    Word raw_prec;
+    std::array<uint32_t, NbWords * 32> bounce_counts;
+
+    // decrement the non-zero counters of word w nb_ticks times, returns the still locked inputs
+    uint32_t countdown(std::size_t w, uint32_t nb_ticks){
+        uint32_t locked = lock_mask(w);
+        for (uint32_t s = 0; (s < nb_ticks) && locked; s++){
+            uint32_t borrow = locked;
+            for (std::size_t p = 0; p < NbPlanes; p++){
+                const uint32_t bits = planes[p][w];
+                planes[p][w] = bits ^ borrow;
+                borrow &= ~bits;
+            }
+            locked = lock_mask(w);
+        }
+        return locked;
+    }
+
+    // an input accepted just before a tick loses up to one tick of lockout : one more tick
+    uint32_t settle_ticks(uint32_t settle_us) const {
+        assert(settle_fits(settle_us, tick) && "debounce settle time too long for the tick : more planes or a longer tick needed");
+        return std::min((settle_us + tick - 1) / tick + 1, max_settle_ticks);
+    }
+
+    // smallest counter value of the inputs of word w (bit-sliced, from the high plane)
+    uint32_t min_counter(std::size_t w, uint32_t inputs) const {
+        uint32_t value = 0;
+        for (std::size_t p = NbPlanes; p-- > 0;){
+            const uint32_t zeros = inputs & ~planes[p][w];
+            if (zeros){
+                inputs = zeros;
+            }
+            else {
+                value |= 1u << p;
+            }
+        }
+        return value;
+    }
+
+    uint32_t lock_mask(std::size_t w) const {
+        uint32_t locked = 0;
+        for (std::size_t p = 0; p < NbPlanes; p++){
+            locked |= planes[p][w];
+        }
+        return locked;
+    }
+};
@@ -0,0 +1,110 @@
+#include <array>
+#include <atomic>
+#include <utility>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "event_log.hpp"
+
+static const char TAG[] = "pedalboard:log";
+
+static_assert((EVENT_LOG_SIZE & (EVENT_LOG_SIZE - 1)) == 0, "EVENT_LOG_SIZE must be a power of 2");
+
+struct LogRecord{
+    int64_t timestamp_us;
+    uint32_t args[2];
+    LogEvent_e event;
+};
+
+// Bounded multi producers / single consumer ring : each slot sequence number tells
+// whether it is free for the producer of position pos (seq == pos) or filled (seq == pos + 1)
+struct LogSlot{
+    std::atomic<uint32_t> seq;
+    LogRecord record;
+};
+
+static std::array<LogSlot, EVENT_LOG_SIZE> log_slots;
+static std::atomic<uint32_t> log_head{0};  // next position reserved by a producer
+static uint32_t log_tail = 0;              // next position read by the drain task
+static std::atomic<uint32_t> log_drops{0};
+
+static const char *const log_formats[] = {
+    "Note OFF : %lu",
+    "Note ON : %lu, velocity %lu",
+    "pedals[%lu] : %08lx",
+    "MIDI OUT : %lu bytes %08lx",
+    "MIDI IN : %lu bytes %08lx",
+    "MIDI OUT queue full, event %08lx dropped",
+};
+static_assert(sizeof(log_formats) / sizeof(log_formats[0]) == std::to_underlying(LogEvent_e::NB_EVENTS));
+
+void event_log(LogEvent_e event, uint32_t arg0, uint32_t arg1)
+{
+    uint32_t pos = log_head.load(std::memory_order_relaxed);
+    LogSlot *slot;
+    while (true){
+        slot = &log_slots[pos & (EVENT_LOG_SIZE - 1)];
+        const int32_t diff = static_cast<int32_t>(slot->seq.load(std::memory_order_acquire) - pos);
+        if (diff == 0){
+            if (log_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                break;
+            }
+        } else if (diff < 0){
+            log_drops.fetch_add(1, std::memory_order_relaxed);  // full
+            return;
+        } else {
+            pos = log_head.load(std::memory_order_relaxed);
+        }
+    }
+    slot->record = LogRecord{esp_timer_get_time(), {arg0, arg1}, event};
+    slot->seq.store(pos + 1, std::memory_order_release);
+}
+
+uint32_t event_log_drops(void)
+{
+    return log_drops.load(std::memory_order_relaxed);
+}
+
+static bool event_log_pop(LogRecord& record)
+{
+    LogSlot& slot = log_slots[log_tail & (EVENT_LOG_SIZE - 1)];
+    if (slot.seq.load(std::memory_order_acquire) != log_tail + 1){
+        return false;
+    }
+    record = slot.record;
+    slot.seq.store(log_tail + EVENT_LOG_SIZE, std::memory_order_release);
+    log_tail++;
+    return true;
+}
+
+static void event_log_task(void *arg)
+{
+    uint32_t drops_prec = 0;
+    while (true){
+        LogRecord record;
+        while (event_log_pop(record)){
+            char message[64];
+            snprintf(message, sizeof(message), log_formats[std::to_underlying(record.event)],
+                static_cast<unsigned long>(record.args[0]), static_cast<unsigned long>(record.args[1]));
+            ESP_LOGI(TAG, "%lld.%06lld %s", static_cast<long long>(record.timestamp_us / 1000000),
+                static_cast<long long>(record.timestamp_us % 1000000), message);
+        }
+        const uint32_t drops = event_log_drops();
+        if (drops != drops_prec){
+            ESP_LOGW(TAG, "%lu records dropped", static_cast<unsigned long>(drops - drops_prec));
+            drops_prec = drops;
+        }
+        vTaskDelay(pdMS_TO_TICKS(EVENT_LOG_DRAIN_PERIOD_MS));
+    }
+}
+
+void event_log_install(const TaskConfig& task_config)
+{
+    for (uint32_t i = 0; i < EVENT_LOG_SIZE; i++){
+        log_slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+    task_config.create(event_log_task, NULL);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+#include "freertos/FreeRTOS.h"
+
+#include "task_config.hpp"
+
+// Deferred event log : the real-time paths only store a small binary record
+// (event, timestamp, 2 arguments) in a lock-free ring, a low priority task formats
+// and prints them. Records are dropped (and counted) when the ring is full.
+enum class LogEvent_e : uint8_t
+{
+    NOTE_OFF,          // pedal
+    NOTE_ON,           // pedal, velocity
+    PEDALS,            // word index, pedals states word
+    MIDI_OUT_XFER,     // bytes, first event packet
+    MIDI_IN_XFER,      // bytes, first event packet
+    MIDI_OUT_DROPPED,  // queue full : event packet
+    NB_EVENTS
+};
+
+#define EVENT_LOG_SIZE 256         // records, power of 2
+#define EVENT_LOG_DRAIN_PERIOD_MS 50
+
+// creates the drain task, to be called before the first event_log()
+void event_log_install(const TaskConfig& task_config);
+
+// real-time safe (any task, no lock, no allocation, no output)
+void event_log(LogEvent_e event, uint32_t arg0 = 0, uint32_t arg1 = 0);
+uint32_t event_log_drops(void);
+
+// USB-MIDI event packet bytes as one word (printed in byte order)
+constexpr uint32_t event_log_packet(const uint8_t *bytes)
+{
+    return (uint32_t{bytes[0]} << 24) | (uint32_t{bytes[1]} << 16) | (uint32_t{bytes[2]} << 8) | bytes[3];
+}
@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <bit>
+#include <utility>
+
+#include "esp_log.h"
+
+#include "latency_stats.hpp"
+
+static const char TAG[] = "pedalboard:latency";
+
+std::size_t LatencyHistogram::bucket(uint32_t latency_us)
+{
+    if (latency_us < 4){
+        return latency_us;
+    }
+    const unsigned msb = std::bit_width(latency_us) - 1;  // >= 2
+    const unsigned sub = (latency_us >> (msb - 2)) & 0x3;
+    return 4 * (msb - 1) + sub;
+}
+
+uint32_t LatencyHistogram::bucket_upper_bound(std::size_t index)
+{
+    if (index < 4){
+        return index;
+    }
+    const unsigned msb = index / 4 + 1;
+    const unsigned sub = index % 4;
+    return static_cast<uint32_t>(((uint64_t{4} + sub + 1) << (msb - 2)) - 1);
+}
+
+void LatencyHistogram::record(int64_t latency_us)
+{
+    const uint32_t value = static_cast<uint32_t>(std::clamp<int64_t>(latency_us, 0, UINT32_MAX));
+    counts[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    uint32_t prev_max = max_us.load(std::memory_order_relaxed);
+    while ((value > prev_max) && !max_us.compare_exchange_weak(prev_max, value, std::memory_order_relaxed)){}
+}
+
+void LatencyHistogram::reset(void)
+{
+    for (auto& c : counts){
+        c.store(0, std::memory_order_relaxed);
+    }
+    max_us.store(0, std::memory_order_relaxed);
+}
+
+uint32_t LatencyHistogram::count(void) const
+{
+    uint32_t total = 0;
+    for (const auto& c : counts){
+        total += c.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint32_t LatencyHistogram::percentile(uint32_t percent) const
+{
+    const uint32_t total = count();
+    if (total == 0){
+        return 0;
+    }
+    // rank of the percentile, rounded up
+    const uint64_t rank = (static_cast<uint64_t>(total) * percent + 99) / 100;
+    uint64_t cumulated = 0;
+    for (std::size_t b = 0; b < NbBuckets; b++){
+        cumulated += counts[b].load(std::memory_order_relaxed);
+        if ((cumulated >= rank) && (cumulated > 0)){
+            return std::min(bucket_upper_bound(b), max());
+        }
+    }
+    return max();
+}
+
+static std::array<LatencyHistogram, std::to_underlying(LatencyStage_e::NB_STAGES)> latency_histograms;
+
+static const char *const latency_stage_names[] = {
+    "read->edge",
+    "edge->enqueue",
+    "enqueue->submit",
+    "submit->done",
+    "pedal->wire",
+};
+
+void latency_record(LatencyStage_e stage, int64_t latency_us)
+{
+    latency_histograms[std::to_underlying(stage)].record(latency_us);
+}
+
+void latency_report(void)
+{
+    for (std::size_t s = 0; s < latency_histograms.size(); s++){
+        const LatencyHistogram& h = latency_histograms[s];
+        if (h.count() == 0){
+            continue;
+        }
+        ESP_LOGI(TAG, "%-16s n=%lu p50=%lu p90=%lu p99=%lu max=%lu us", latency_stage_names[s],
+            static_cast<unsigned long>(h.count()),
+            static_cast<unsigned long>(h.percentile(50)),
+            static_cast<unsigned long>(h.percentile(90)),
+            static_cast<unsigned long>(h.percentile(99)),
+            static_cast<unsigned long>(h.max()));
+    }
+}
+
+void latency_reset(void)
+{
+    for (auto& h : latency_histograms){
+        h.reset();
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Fixed buckets latency histogram (microseconds), no allocation, safe to record from any task.
+// Log-linear buckets : 4 sub-buckets per power of 2 (< 25 % error), 0 us .. 2^32 us.
+class LatencyHistogram{
+
+public:
+
+    static constexpr std::size_t NbBuckets = 124;
+
+    LatencyHistogram(): counts{}, max_us{0} {}
+
+    void record(int64_t latency_us);
+    void reset(void);
+
+    uint32_t count(void) const;
+    uint32_t max(void) const {return max_us.load(std::memory_order_relaxed);}
+    // upper bound of the bucket holding the given percentile (0..100)
+    uint32_t percentile(uint32_t percent) const;
+
+    static std::size_t bucket(uint32_t latency_us);
+    static uint32_t bucket_upper_bound(std::size_t index);
+
+private:
+    std::array<std::atomic<uint32_t>, NbBuckets> counts;
+    std::atomic<uint32_t> max_us;
+};
+
+// Pedal to wire pipeline stages
+enum class LatencyStage_e : uint8_t
+{
+    READ_TO_EDGE,       // I2C read completion -> edge detection (debounce included)
+    EDGE_TO_ENQUEUE,    // edge detection -> events queued for the USB task
+    ENQUEUE_TO_SUBMIT,  // waiting in the MIDI OUT queue -> usb_host_transfer_submit
+    SUBMIT_TO_DONE,     // OUT transfer on the wire -> transfer done callback
+    PEDAL_TO_WIRE,      // I2C read completion -> transfer done callback (end to end)
+    NB_STAGES
+};
+
+void latency_record(LatencyStage_e stage, int64_t latency_us);
+void latency_report(void);
+void latency_reset(void);
@@ -0,0 +1,346 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+
+#include "midi_packet.hpp"
+
+// queued MIDI OUT event, token identifies it in the completion notifications
+struct MidiOutEvent{
+    MidiEventPacket packet;
+    uint32_t token;      // 0 : pass through packet (no completion report)
+    int64_t origin_us;   // pedal state read time (latency measurements), 0 : pass through packet
+    int64_t enqueue_us;
+    uint8_t devices;     // destination devices mask
+};
+
+// Merge input lanes, highest priority first
+enum class MidiLane_e : uint8_t
+{
+    REALTIME,    // system real time (clock, start / stop, ...) : may be inserted anywhere
+    PEDAL,       // local events (pedal notes, local control)
+    THRU_VOICE,  // pass through channel voice and system common messages
+    SYSEX,       // pass through system exclusive streams
+    NB_LANES
+};
+
+// lane of a packet, local : sent by the pedalboard itself (not pass through)
+constexpr MidiLane_e midi_lane(const MidiEventPacket& packet, bool local)
+{
+    const uint8_t cin = midi_packet_cin(packet);
+    if ((cin == 0xF) && (packet[1] >= 0xF8)){
+        return MidiLane_e::REALTIME;
+    }
+    if (local){
+        return MidiLane_e::PEDAL;
+    }
+    // SysEx start / continue, ends (CIN 5 : single byte system common or 0xF7 end)
+    if ((cin == 0x4) || (cin == 0x6) || (cin == 0x7) || ((cin == 0x5) && (packet[1] == 0xF7))){
+        return MidiLane_e::SYSEX;
+    }
+    return MidiLane_e::THRU_VOICE;
+}
+
+// queueing delay of one lane (lane push -> taken for an OUT transfer)
+struct MidiLaneStats{
+    uint32_t nb_packets;
+    uint32_t nb_drops;     // lane full
+    uint32_t mean_delay_us;
+    uint32_t max_delay_us;
+};
+
+// OUT packets merge of one device : one FIFO per lane, packets taken one by one
+// (transfers are always split at event packet boundaries). Policy, at each packet :
+//   1. real time messages
+//   2. the SysEx message being sent, until its end : no other message inside it (MIDI 1.0).
+//      While it is open, the other packets of its cable are held, even when its next
+//      packets are not received yet (SysEx longer than one IN transfer). After SysexHoldUs
+//      without any of its packets received (MidiOutEvent::enqueue_us, none of them queued),
+//      the message is ended (0xF7 sent) and its rest dropped. A stalled OUT endpoint does
+//      not end it : the hold is timed from the receive time, not from the send time.
+//   3. pedal events (bounded by the player, they cannot starve the lanes below)
+//   4. pass through voice messages, then a new SysEx message. A SysEx message waiting
+//      for more than MaxSysexWait transfers goes before the voice messages.
+// Lanes only used by the USB task, statistics read from any task.
+template<std::size_t LaneSize, uint32_t MaxSysexWait = 4, int64_t SysexHoldUs = 50000>
+class MidiMerger{
+    static_assert((LaneSize != 0) && ((LaneSize & (LaneSize - 1)) == 0), "MidiMerger lane size must be a power of 2");
+
+    static constexpr std::size_t NbLanes = std::to_underlying(MidiLane_e::NB_LANES);
+    static constexpr std::size_t NbCables = 16;
+
+    struct Lane{
+        std::array<MidiOutEvent, LaneSize> events;
+        std::size_t head;   // free running indexes
+        std::size_t tail;
+        std::atomic<uint32_t> nb_packets;
+        std::atomic<uint32_t> nb_drops;
+        std::atomic<uint32_t> sum_delay_us;
+        std::atomic<uint32_t> max_delay_us;
+
+        bool empty(void) const {return head == tail;}
+        auto front(void) const -> const MidiOutEvent& {return events[tail & (LaneSize - 1)];}
+    };
+
+    std::array<Lane, NbLanes> m_lanes;
+    uint16_t m_sysex_open;     // bit c : SysEx message started on cable c, not ended yet
+    uint16_t m_sysex_eox;      // bit c : SysEx message of cable c timed out, its end to send
+    uint16_t m_sysex_dropped;  // bit c : rest of a timed out message dropped, until a new one
+    std::array<int64_t, NbCables> m_sysex_us;        // last SysEx packet received (pushed) per cable
+    std::array<uint16_t, NbCables> m_sysex_queued;   // SysEx packets in the lane per cable
+    uint32_t m_sysex_wait;     // transfers filled while a SysEx message was waiting
+    bool m_sysex_sent;         // SysEx packet in the current transfer
+    std::atomic<uint32_t> m_sysex_timeouts;
+
+    auto lane(MidiLane_e l) -> Lane& {return m_lanes[std::to_underlying(l)];}
+
+    // next packet of the lane belongs to a cable inside a SysEx message
+    bool held(const Lane& q) const
+    {
+        return (m_sysex_open >> midi_packet_cable(q.front().packet)) & 1;
+    }
+
+    auto next_lane(void) -> Lane*
+    {
+        if (!lane(MidiLane_e::REALTIME).empty()){
+            return &lane(MidiLane_e::REALTIME);
+        }
+        Lane& sysex = lane(MidiLane_e::SYSEX);
+        if ((m_sysex_open != 0) && !sysex.empty()){
+            return &sysex;
+        }
+        Lane& pedal = lane(MidiLane_e::PEDAL);
+        if (!pedal.empty() && !held(pedal)){
+            return &pedal;
+        }
+        Lane& voice = lane(MidiLane_e::THRU_VOICE);
+        const bool voice_ready = !voice.empty() && !held(voice);
+        if (!sysex.empty() && (!voice_ready || (m_sysex_wait >= MaxSysexWait))){
+            return &sysex;
+        }
+        return voice_ready ? &voice : NULL;
+    }
+
+    void sysex_track(const MidiEventPacket& packet)
+    {
+        const uint8_t cable = midi_packet_cable(packet);
+        m_sysex_queued[cable]--;
+        if (midi_packet_cin(packet) == 0x4){
+            m_sysex_open |= 1u << cable;
+        } else {
+            m_sysex_open &= ~(1u << cable);
+        }
+        m_sysex_sent = true;
+        m_sysex_wait = 0;
+    }
+
+    // open messages without any packet received for SysexHoldUs are ended
+    void sysex_expire(int64_t now_us)
+    {
+        uint16_t open = m_sysex_open;
+        while (open){
+            const uint8_t cable = std::countr_zero(open);
+            if ((m_sysex_queued[cable] == 0) && (now_us - m_sysex_us[cable] >= SysexHoldUs)){
+                m_sysex_open &= ~(1u << cable);
+                m_sysex_eox |= 1u << cable;
+                m_sysex_dropped |= 1u << cable;
+                m_sysex_timeouts.fetch_add(1, std::memory_order_relaxed);
+            }
+            open &= open - 1;
+        }
+    }
+
+    // late packets of the timed out messages, until a new message start
+    void sysex_drop_late(void)
+    {
+        Lane& sysex = lane(MidiLane_e::SYSEX);
+        while ((m_sysex_dropped != 0) && !sysex.empty()){
+            const MidiEventPacket& packet = sysex.front().packet;
+            const uint16_t cable = 1u << midi_packet_cable(packet);
+            if (!(m_sysex_dropped & cable)){
+                break;
+            }
+            if (packet[1] == 0xF0){
+                m_sysex_dropped &= ~cable;
+                break;
+            }
+            if (midi_packet_cin(packet) != 0x4){
+                m_sysex_dropped &= ~cable;  // end of the dropped message
+            }
+            m_sysex_queued[midi_packet_cable(packet)]--;
+            sysex.tail++;
+            sysex.nb_drops.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+public:
+    MidiMerger():
+    m_lanes{}, m_sysex_open{0}, m_sysex_eox{0}, m_sysex_dropped{0}, m_sysex_us{}, m_sysex_queued{},
+    m_sysex_wait{0}, m_sysex_sent{false}, m_sysex_timeouts{0}
+    {}
+
+    MidiMerger(const MidiMerger&) = delete;
+    MidiMerger& operator=(const MidiMerger&) = delete;
+
+    // false (and event dropped) if the lane is full
+    bool push(MidiLane_e l, const MidiOutEvent& event)
+    {
+        Lane& q = lane(l);
+        if (q.head - q.tail >= LaneSize){
+            q.nb_drops.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        q.events[q.head & (LaneSize - 1)] = event;
+        q.head++;
+        if (l == MidiLane_e::SYSEX){
+            const uint8_t cable = midi_packet_cable(event.packet);
+            m_sysex_us[cable] = std::max(m_sysex_us[cable], event.enqueue_us);
+            m_sysex_queued[cable]++;
+        }
+        return true;
+    }
+
+    bool full(MidiLane_e l) const
+    {
+        const Lane& q = m_lanes[std::to_underlying(l)];
+        return q.head - q.tail >= LaneSize;
+    }
+
+    // a packet can be sent now (false : lanes empty, or held by an open SysEx message)
+    bool ready(int64_t now_us)
+    {
+        sysex_expire(now_us);
+        sysex_drop_late();
+        return (m_sysex_eox != 0) || (next_lane() != NULL);
+    }
+
+    // packets waiting for the end of a SysEx message : pop() needed within SysexHoldUs
+    // even if nothing else is pushed
+    bool holding(void) const
+    {
+        return (m_sysex_open != 0) && !empty();
+    }
+
+    // next packet to send according to the policy, false if nothing can be sent
+    bool pop(MidiOutEvent& event, int64_t now_us)
+    {
+        sysex_expire(now_us);
+        sysex_drop_late();
+        if (m_sysex_eox != 0){
+            // end of a timed out message (pass through packet, no completion report)
+            const uint8_t cable = std::countr_zero(m_sysex_eox);
+            m_sysex_eox &= ~(1u << cable);
+            event = MidiOutEvent{{static_cast<uint8_t>((cable << 4) | 0x5), 0xF7, 0, 0}, 0, 0, now_us, 0};
+            m_sysex_sent = true;
+            return true;
+        }
+        Lane* q = next_lane();
+        if (q == NULL){
+            return false;
+        }
+        event = q->front();
+        q->tail++;
+        if (q == &lane(MidiLane_e::SYSEX)){
+            sysex_track(event.packet);
+        }
+        const uint32_t delay_us = static_cast<uint32_t>(std::clamp<int64_t>(now_us - event.enqueue_us, 0, UINT32_MAX));
+        q->nb_packets.fetch_add(1, std::memory_order_relaxed);
+        q->sum_delay_us.fetch_add(delay_us, std::memory_order_relaxed);
+        if (delay_us > q->max_delay_us.load(std::memory_order_relaxed)){
+            q->max_delay_us.store(delay_us, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    // one OUT transfer : packets popped into buffer (whole packets, at most max_events),
+    // f(const MidiOutEvent&) called for each of them. Returns the bytes written
+    template<typename F>
+    std::size_t pop_transfer(std::span<uint8_t> buffer, std::size_t max_events, int64_t now_us, F&& f)
+    {
+        std::size_t nb_bytes = 0;
+        MidiOutEvent event;
+        for (std::size_t e = 0; (e < max_events) && (nb_bytes + event.packet.size() <= buffer.size()) && pop(event, now_us); e++){
+            std::copy(event.packet.begin(), event.packet.end(), buffer.begin() + nb_bytes);
+            nb_bytes += event.packet.size();
+            f(event);
+        }
+        end_transfer();
+        return nb_bytes;
+    }
+
+    // one OUT transfer filled : SysEx starvation accounting
+    void end_transfer(void)
+    {
+        if (!m_sysex_sent && !lane(MidiLane_e::SYSEX).empty()){
+            m_sysex_wait++;
+        }
+        m_sysex_sent = false;
+    }
+
+    bool empty(void) const
+    {
+        return std::all_of(m_lanes.begin(), m_lanes.end(), [](const Lane& q){return q.empty();});
+    }
+
+    // nothing queued and no SysEx message in progress : packets without SysEx can be sent
+    // as they are, bypassing the lanes, in the order the merge would have given
+    bool idle(void) const
+    {
+        return empty() && (m_sysex_open == 0) && (m_sysex_eox == 0) && (m_sysex_dropped == 0);
+    }
+
+    // every lane emptied (device closed), statistics kept
+    void clear(void)
+    {
+        for (Lane& q : m_lanes){
+            q.tail = q.head;
+        }
+        m_sysex_open = 0;
+        m_sysex_eox = 0;
+        m_sysex_dropped = 0;
+        m_sysex_queued.fill(0);
+        m_sysex_wait = 0;
+        m_sysex_sent = false;
+    }
+
+    auto stats(MidiLane_e l) const -> MidiLaneStats
+    {
+        const Lane& q = m_lanes[std::to_underlying(l)];
+        const uint32_t nb_packets = q.nb_packets.load(std::memory_order_relaxed);
+        return MidiLaneStats{
+            .nb_packets = nb_packets,
+            .nb_drops = q.nb_drops.load(std::memory_order_relaxed),
+            .mean_delay_us = nb_packets ? q.sum_delay_us.load(std::memory_order_relaxed) / nb_packets : 0,
+            .max_delay_us = q.max_delay_us.load(std::memory_order_relaxed),
+        };
+    }
+
+    // SysEx messages ended by the hold timeout
+    uint32_t sysex_timeouts(void) const {return m_sysex_timeouts.load(std::memory_order_relaxed);}
+
+    uint32_t drops(void) const
+    {
+        uint32_t total = 0;
+        for (const Lane& q : m_lanes){
+            total += q.nb_drops.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    void reset_stats(void)
+    {
+        for (Lane& q : m_lanes){
+            q.nb_packets.store(0, std::memory_order_relaxed);
+            q.nb_drops.store(0, std::memory_order_relaxed);
+            q.sum_delay_us.store(0, std::memory_order_relaxed);
+            q.max_delay_us.store(0, std::memory_order_relaxed);
+        }
+        m_sysex_timeouts.store(0, std::memory_order_relaxed);
+    }
+};
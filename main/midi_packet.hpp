@@ -0,0 +1,38 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// USB-MIDI event packet : cable number / code index number, then 3 MIDI bytes
+using MidiEventPacket = std::array<uint8_t, 4>;
+
+constexpr uint8_t midi_packet_cable(const MidiEventPacket& packet) {return packet[0] >> 4;}
+constexpr uint8_t midi_packet_cin(const MidiEventPacket& packet) {return packet[0] & 0x0F;}
+
+// MIDI bytes carried by a packet of the given code index number (0 : reserved CIN)
+constexpr std::size_t midi_cin_size(uint8_t cin)
+{
+    constexpr std::array<uint8_t, 16> sizes{0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1};
+    return sizes[cin & 0x0F];
+}
+
+// Event packets of a USB-MIDI buffer, read in place (trailing partial packet ignored)
+class MidiPacketReader{
+
+public:
+
+    explicit MidiPacketReader(std::span<const uint8_t> buffer): data{buffer.data()}, nb_packets{buffer.size() / 4} {}
+
+    std::size_t size(void) const {return nb_packets;}
+
+    MidiEventPacket operator[](std::size_t i) const {
+        const uint8_t *p = data + 4 * i;
+        return {p[0], p[1], p[2], p[3]};
+    }
+
+private:
+    const uint8_t *data;
+    std::size_t nb_packets;
+};
@@ -1,143 +1,576 @@
-#include <iostream>
-#include <thread>
-#include <chrono>
-#include <vector>
-#include <bitset>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+
+#include "esp_attr.h"
+#include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
 
 #include "rgb_led.hpp"
 
 #include "i2c_master_bus.hpp"
 //#include "i2c_master_device.hpp"
 #include "mcp23017.hpp"
+#include "mcp23017_array.hpp"
 
 #include "usb.hpp"
 #include "usb_midi.hpp"
+#include "scan_scheduler.hpp"
+#include "debouncer.hpp"
+#include "latency_stats.hpp"
+#include "event_log.hpp"
+#include "pedal_midi_map.hpp"
+#include "pedal_word.hpp"
+#include "pedal_velocity.hpp"
+#include "task_config.hpp"
+#include "boot_timeline.hpp"
+#include "benchmarks.hpp"
 
-using namespace std::chrono_literals;
+static const char TAG[] = "pedalboard";
 
 #define LED_GPIO 18  // GPIO18 on SAOLA-1 devboard
 
+#define PDB_NB_PEDALS 30
 #define PDB_FIRST_MIDI_NOTE 0x3C
+#define PDB_MIDI_CHANNEL 0
+#define PDB_MIDI_VELOCITY 0x40
+
+// notes played by each pedal : its own note and the fifth above (semitones)
+static constexpr std::array<uint8_t, 2> pedal_note_intervals{0, 7};
+
+static_assert(pedal_midi_map_valid<PDB_NB_PEDALS>(PDB_FIRST_MIDI_NOTE, pedal_note_intervals), "pedal notes out of the MIDI range");
+
+// Pedal contacts : 1 = two contacts per pedal (input 2p early make, 2p + 1 late make),
+// velocity from the time between them. 0 = one contact per pedal (input p), fixed velocity
+#define PDB_DUAL_CONTACT 0
+#define PDB_NB_CONTACTS (PDB_NB_PEDALS * (PDB_DUAL_CONTACT ? 2 : 1))
+// MCP23017 on sub addresses 0..PDB_NB_EXPANDERS-1, 16 contacts each (2 single contact, 4 dual contact)
+#define PDB_NB_EXPANDERS ((PDB_NB_CONTACTS + 15) / 16)
+#define PDB_VELOCITY_MIN_US 2000   // contacts delay of the loudest note (127)
+#define PDB_VELOCITY_MAX_US 40000  // contacts delay of the softest note (1)
+
+static constexpr VelocityCurve pedal_velocity_curve = make_velocity_curve(PDB_VELOCITY_MIN_US, PDB_VELOCITY_MAX_US, VelocityShape_e::LINEAR);
+
+static_assert(PDB_NB_EXPANDERS <= 8, "MCP23017 : 8 sub addresses available");
+
+static constexpr auto pedal_midi_map = make_pedal_midi_map<PDB_NB_PEDALS>(
+    PDB_FIRST_MIDI_NOTE, pedal_note_intervals, PDB_MIDI_VELOCITY, PDB_MIDI_CHANNEL);
+static_assert(pedal_midi_map.note_on.size() == PDB_NB_PEDALS && pedal_midi_map.note_off.size() == PDB_NB_PEDALS);
+static_assert(pedal_midi_map.note_on[0].packets[0] == MidiEventPacket{0x09, 0x90 | PDB_MIDI_CHANNEL, PDB_FIRST_MIDI_NOTE, PDB_MIDI_VELOCITY});
+static_assert(pedal_note_intervals.size() <= MIDI_OUT_XFER_MAX_EVENTS, "pedal events larger than one OUT transfer");
+
+// Contact bounces : pedal locked after each accepted change (lockout counted in µs, whatever the scan rate)
+#define PDB_DEBOUNCE_SETTLE_US 5000
+#define PDB_DEBOUNCE_TICK_US 500       // lockout resolution
+static_assert(Debouncer<PDB_NB_CONTACTS>::settle_fits(PDB_DEBOUNCE_SETTLE_US, PDB_DEBOUNCE_TICK_US),
+    "debounce settle time longer than the lockout counters : longer PDB_DEBOUNCE_TICK_US needed");
+
+// Pedals scan mode : 1 = woken up by MCP23017 INT pins, 0 = hardware timer paced polling
+#define PDB_SCAN_INTERRUPT_DRIVEN 1
+#define PDB_SCAN_PERIOD_US 2000        // polling period (2 blocking gpio reads take ~1 ms at 100 kHz)
+#define PDB_SCAN_STATS_PERIOD_S 10     // scan and bounce statistics logged every ... seconds
+#define PDB_SCAN_IDLE_TIMEOUT_MS 100   // max wait without interrupt (disconnected gpio retry)
+#define PDB_SCAN_PROFILE 0             // 1 = scan time vs number of MCP23017 measured at boot
+
+// MCP23017 INTA/INTB pins (mirrored, open-drain), one per expander : expander n (sub address n)
+// INT on the n-th pin listed, the first PDB_NB_EXPANDERS pins are used
+static constexpr std::array<gpio_num_t, 4> expander_int_pin_list{GPIO_NUM_10, GPIO_NUM_11, GPIO_NUM_12, GPIO_NUM_13};
+static_assert(PDB_NB_EXPANDERS <= expander_int_pin_list.size(), "one INT pin per MCP23017 needed");
+static constexpr auto expander_int_pins = [](){
+    std::array<gpio_num_t, PDB_NB_EXPANDERS> pins{};
+    std::copy_n(expander_int_pin_list.begin(), pins.size(), pins.begin());
+    return pins;
+}();
+
+// MIDI IN -> OUT pass through : 1 = MIDI clock and active sensing filtered out
+#define PDB_MIDI_THRU_DROP_CLOCK 1
+// MIDI devices (behind a hub) : pedal events destinations (bit d : device slot d),
+// pass through 0 = back to the sending device only, 1 = to every device
+#define PDB_MIDI_OUT_DEVICES MIDI_ALL_DEVICES
+#define PDB_MIDI_THRU_ALL_DEVICES 0
+
+// I2C bus mode : 1 = asynchronous, the polling scan queues all gpio reads at once
+#define PDB_I2C_ASYNC 0
+#define PDB_I2C_QUEUE_DEPTH 4
+#define PDB_I2C_ASYNC_TIMEOUT_US 10000  // all gpio reads done within ... (else chips marked failed)
+
+// tasks priority / stack / core (menuconfig "MIDI pedalboard tasks")
+static constexpr PedalboardTasks pedalboard_tasks = pedalboard_tasks_default();
+
+// task notification bits set by the INT pins ISR (bit n : expander n) / I2C ISR
+#define PDB_NOTIFY_EXPANDERS ((1u << PDB_NB_EXPANDERS) - 1)
+#define PDB_NOTIFY_I2C_DONE 0x100
+#define PDB_NOTIFY_SCAN_TICK 0x200
+#define PDB_NOTIFY_LOCKOUT_END 0x400
+
+static TaskHandle_t scan_task_hdl = NULL;
 
-template<std::size_t N>
-std::bitset<N>& operator<<(std::bitset<N>& bits, const uint8_t& byte){
-    bits <<= 8;
-    bits |= byte;
-    return bits;
+#if !PDB_SCAN_INTERRUPT_DRIVEN && PDB_I2C_ASYNC
+// wait for one notification bit (false : timeout). The other bits received meanwhile are
+// left for their own waiter, notified again so that it does not miss them
+static bool notify_wait_bit(uint32_t bit, int64_t timeout_us)
+{
+    const int64_t deadline_us = esp_timer_get_time() + timeout_us;
+    uint32_t notified = 0;
+    while ((notified & bit) == 0){
+        const int64_t remaining_us = deadline_us - esp_timer_get_time();
+        if (remaining_us <= 0){
+            break;
+        }
+        xTaskNotifyWait(0, bit, &notified, pdMS_TO_TICKS((remaining_us + 999) / 1000) + 1);
+    }
+    if (notified & ~bit){
+        xTaskNotify(xTaskGetCurrentTaskHandle(), 0, eNoAction);
+    }
+    return (notified & bit) != 0;
+}
+#endif
+
+using Expanders = MCP23017::ExpanderArray<PDB_NB_EXPANDERS>;
+
+#if !PDB_SCAN_INTERRUPT_DRIVEN && PDB_I2C_ASYNC
+// I2C ISR context : last expander read of the scan done
+static bool expanders_read_done(void *arg)
+{
+    BaseType_t task_woken = pdFALSE;
+    xTaskNotifyFromISR(scan_task_hdl, PDB_NOTIFY_I2C_DONE, eSetBits, &task_woken);
+    return task_woken == pdTRUE;
 }
+#endif
+
+#if PDB_SCAN_INTERRUPT_DRIVEN
+// INT falling edge time per expander (0 : taken by the scan loop) : time of the first
+// input change of the interrupt, the one captured in INTCAP
+static std::array<std::atomic<int64_t>, PDB_NB_EXPANDERS> expander_int_us;
 
-template<std::size_t N>
-std::bitset<N>& operator<<(std::bitset<N>& bits, const std::vector<uint8_t>& vect){
-    std::for_each(vect.crbegin(), vect.crend(), [&bits](const uint8_t byte) { bits << byte; });
-    return bits;
+static void IRAM_ATTR expander_int_isr(void *arg)
+{
+    const uint32_t expander_bit = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(arg));
+    expander_int_us[std::countr_zero(expander_bit)].store(esp_timer_get_time(), std::memory_order_relaxed);
+    BaseType_t task_woken = pdFALSE;
+    xTaskNotifyFromISR(scan_task_hdl, expander_bit, eSetBits, &task_woken);
+    portYIELD_FROM_ISR(task_woken);
 }
 
+static void expander_int_install(void)
+{
+    uint64_t pin_bit_mask = 0;
+    for (const gpio_num_t pin : expander_int_pins){
+        pin_bit_mask |= 1ULL << pin;
+    }
+    const gpio_config_t int_pins_config = {
+        .pin_bit_mask = pin_bit_mask,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE, // INT pins are open-drain, active low
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_NEGEDGE,
+    };
+    ESP_ERROR_CHECK(gpio_config(&int_pins_config));
+    ESP_ERROR_CHECK(gpio_install_isr_service(0));
+    for (std::size_t e = 0; e < expander_int_pins.size(); e++){
+        ESP_ERROR_CHECK(gpio_isr_handler_add(expander_int_pins[e], expander_int_isr, reinterpret_cast<void*>(1u << e)));
+    }
+}
+
+// expanders to read : interrupt notified, or INT pin still low
+// (edge missed while the previous interrupt was not cleared)
+static uint32_t expander_int_pending(uint32_t notified)
+{
+    uint32_t pending = notified & PDB_NOTIFY_EXPANDERS;
+    for (std::size_t e = 0; e < expander_int_pins.size(); e++){
+        if (gpio_get_level(expander_int_pins[e]) == 0){
+            pending |= 1u << e;
+        }
+    }
+    return pending;
+}
+
+// end of a pedal lockout : the pedals still bouncing read again then (no INT edge if
+// the contact settled back during the lockout). FreeRTOS ticks (10 ms) are too coarse
+static esp_timer_handle_t lockout_timer = NULL;
+
+static void lockout_timer_cb(void *arg)
+{
+    xTaskNotify(scan_task_hdl, PDB_NOTIFY_LOCKOUT_END, eSetBits);
+}
+
+static void lockout_timer_create(void)
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = lockout_timer_cb,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "pdb_lockout",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &lockout_timer));
+}
+
+// (re)armed at each scan : one pending lockout end at most
+static void lockout_timer_start(int64_t timeout_us)
+{
+    esp_timer_stop(lockout_timer);  // ESP_ERR_INVALID_STATE if not running
+    ESP_ERROR_CHECK(esp_timer_start_once(lockout_timer, std::max<int64_t>(timeout_us, 0)));
+}
+#endif
+
+// Scan statistics snapshot : taken by the scan loop (copies only), printed by the
+// low priority stats task, so that the logging output never delays a scan
+struct ScanStats{
+#if !PDB_SCAN_INTERRUPT_DRIVEN
+    uint32_t period_us;
+    ScanPeriodStats periods;
+#endif
+    Expanders::Stats_t expanders;
+    std::array<uint32_t, PDB_NB_CONTACTS> bounces;
+#if PDB_DUAL_CONTACT
+    uint32_t missed_early;
+#endif
+};
+
+static ScanStats scan_stats;
+static std::atomic<bool> scan_stats_pending{false};  // snapshot taken, not printed yet
+static TaskHandle_t stats_task_hdl = NULL;
+
+static void log_bounces(const std::array<uint32_t, PDB_NB_CONTACTS>& bounces)
+{
+    for (std::size_t p = 0; p < bounces.size(); p++){
+        if (bounces[p] > 0){
+            ESP_LOGI(TAG, "contact %u : %lu bounce(s)", static_cast<unsigned>(p), static_cast<unsigned long>(bounces[p]));
+        }
+    }
+}
+
+// Statistics task : scan snapshot and the counters of the other tasks (atomic) every
+// PDB_SCAN_STATS_PERIOD_S, boot timeline once every step is reached (first device connection)
+static void stats_task(void *arg)
+{
+    UsbHostMidiClient& usb_midi = *static_cast<UsbHostMidiClient*>(arg);
+    uint32_t thru_forwarded_prec = 0;
+    bool boot_dumped = false;
+
+    while (true){
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+
+        if (!boot_dumped && boot_complete()){
+            boot_dumped = true;
+            boot_timeline_dump();
+        }
+
+        if (!scan_stats_pending.load(std::memory_order_acquire)){
+            continue;
+        }
+#if !PDB_SCAN_INTERRUPT_DRIVEN
+        ScanScheduler::log_stats(scan_stats.period_us, scan_stats.periods);
+#endif
+        Expanders::log_stats(scan_stats.expanders);
+        log_bounces(scan_stats.bounces);
+#if PDB_DUAL_CONTACT
+        if (scan_stats.missed_early > 0){
+            ESP_LOGI(TAG, "%lu note(s) without early contact", static_cast<unsigned long>(scan_stats.missed_early));
+        }
+#endif
+        scan_stats_pending.store(false, std::memory_order_release);
+
+        const uint32_t thru_forwarded = usb_midi.thru_forwarded();
+        ESP_LOGI(TAG, "MIDI thru : %lu packets forwarded (%lu/s), %lu dropped",
+            static_cast<unsigned long>(thru_forwarded),
+            static_cast<unsigned long>((thru_forwarded - thru_forwarded_prec) / PDB_SCAN_STATS_PERIOD_S),
+            static_cast<unsigned long>(usb_midi.thru_dropped()));
+        thru_forwarded_prec = thru_forwarded;
+        usb_midi.log_stats();
+        usb_midi.reset_stats();
+        latency_report();
+        latency_reset();
+    }
+}
+
+using Contacts = PedalWord<PDB_NB_CONTACTS>;
+using ContactTimes = std::array<int64_t, PDB_NB_CONTACTS>;
+
+static_assert(std::tuple_size_v<Contacts> <= std::tuple_size_v<Expanders::Inputs>);
+
+// expander n ports : contacts 16 * n .. 16 * n + 15 (port A first)
+static void contacts_pack(Contacts& contacts, const Expanders::Inputs& inputs)
+{
+    std::copy_n(inputs.begin(), contacts.size(), contacts.begin());
+    pedal_word_mask_unused<PDB_NB_CONTACTS>(contacts);
+}
+
+// Time of the raw edges of the contacts changed by this scan. Expanders read on interrupt :
+// INTCAP changes at the INT edge time (int_us), the later ones (before the interrupt was
+// cleared) at the registers read time. Other expanders (polling, reconnection) : scan time
+static void contacts_edge_times(const Expanders& expanders, const std::array<int64_t, PDB_NB_EXPANDERS>& int_us,
+    const Contacts& raw_prec, const Contacts& raw, int64_t now_us, ContactTimes& edge_us)
+{
+    for (std::size_t c = 0; (c < PDB_NB_EXPANDERS) && (16 * c < PDB_NB_CONTACTS); c++){
+        const std::size_t first = 16 * c;
+        const uint32_t prec = (raw_prec[first / 32] >> (first % 32)) & 0xFFFF;
+        const uint32_t state = (raw[first / 32] >> (first % 32)) & 0xFFFF;
+        uint32_t capture = state;
+        int64_t read_us = now_us;
+        if ((expanders.interrupts_read() & (1u << c)) && (int_us[c] != 0)){
+            const MCP23017::Interrupt_t& interrupt = expanders.interrupt(c);
+            capture = interrupt.captures[0] | (uint32_t{interrupt.captures[1]} << 8);
+            read_us = expanders.interrupt_read_us(c);
+        }
+        uint32_t changed = (state ^ prec) | (capture ^ prec);
+        while (changed){
+            const uint32_t b = std::countr_zero(changed);
+            if (first + b < PDB_NB_CONTACTS){
+                // level reached at the INT edge (captured, no change since) or later
+                const bool at_int = ((capture ^ prec) >> b) & ~((state ^ capture) >> b) & 1;
+                edge_us[first + b] = at_int ? int_us[c] : read_us;
+            }
+            changed &= changed - 1;
+        }
+    }
+}
+
+// note on / off events of one pedal (velocity sensing pedals)
+static void send_pedal_note(UsbHostMidiClient& usb_midi, const PedalNote& note, int64_t origin_us)
+{
+    if (note.note_on){
+        event_log(LogEvent_e::NOTE_ON, note.pedal, note.velocity);
+        usb_midi.send_events(pedal_events_velocity(pedal_midi_map.note_on[note.pedal], note.velocity).events(), origin_us, PDB_MIDI_OUT_DEVICES);
+    } else {
+        event_log(LogEvent_e::NOTE_OFF, note.pedal);
+        usb_midi.send_events(pedal_midi_map.note_off[note.pedal].events(), origin_us, PDB_MIDI_OUT_DEVICES);
+    }
+}
+
+#if CONFIG_PDB_BENCH_SCAN_HEAP
+// scan path of the scan loop, without the MIDI output (blocking reads in every scan mode)
+static void bench_scan(void *arg)
+{
+    Expanders& expanders = *static_cast<Expanders*>(arg);
+    static Debouncer<PDB_NB_CONTACTS> debouncer{PDB_DEBOUNCE_SETTLE_US, PDB_DEBOUNCE_TICK_US};
+    static Contacts status{};
+    Contacts raw{};
+#if PDB_SCAN_INTERRUPT_DRIVEN
+    contacts_pack(raw, expanders.scan_interrupts(PDB_NOTIFY_EXPANDERS));
+#else
+    contacts_pack(raw, expanders.scan());
+#endif
+    const Contacts prec = status;
+    status = debouncer.update(raw, esp_timer_get_time());
+    const PedalEdges<PDB_NB_CONTACTS> edges = pedal_edges<PDB_NB_CONTACTS>(prec, status);
+    for_each_set_bit(edges.pressed, [](std::size_t b){event_log(LogEvent_e::NOTE_ON, b);});
+}
+#endif
+
+#if CONFIG_PDB_BENCH_GLISSANDO
+static std::span<const MidiEventPacket> pedal_events(std::size_t pedal, bool note_on)
+{
+    return note_on ? pedal_midi_map.note_on[pedal].events() : pedal_midi_map.note_off[pedal].events();
+}
+#endif
+
 extern "C" void app_main(void)
 {
+    boot_mark(BootStep_e::APP_MAIN);
+
+    // scan loop above the USB tasks : their callbacks cannot delay a scan
+    vTaskPrioritySet(NULL, pedalboard_tasks.scan_priority);
+    event_log_install(pedalboard_tasks.event_log);
 
     RGBLed led = RGBLed(LED_GPIO);
 
+    // USB host first : the device enumeration (hundreds of ms) runs in the USB tasks
+    // while the expanders are configured
+    usb_itf_install(pedalboard_tasks.usb_lib);
+    static UsbHostMidiClient usb_midi{pedalboard_tasks.usb_midi};  // devices table too large for the main task stack
+    MidiRouter thru_router = MidiRouter::forward_all();
+#if PDB_MIDI_THRU_DROP_CLOCK
+    thru_router.drop_system_msg = MIDI_SYSTEM_CLOCK | MIDI_SYSTEM_ACTIVE_SENSING;
+#endif
+    usb_midi.set_thru_router(thru_router);
+#if PDB_MIDI_THRU_ALL_DEVICES
+    for (std::size_t d = 0; d < MIDI_MAX_DEVICES; d++){
+        usb_midi.set_thru_devices(d, MIDI_ALL_DEVICES);
+    }
+#endif
+    usb_midi.activate_pass_through(true);
+    boot_mark(BootStep_e::USB_HOST_INSTALLED);
+    pedalboard_tasks.stats.create(stats_task, &usb_midi, &stats_task_hdl);
+
     I2CMaster::I2CBus i2c_bus{
         I2C_NUM_0,
         GPIO_NUM_9, // SDA pin
         GPIO_NUM_8, // SCL pin
         false,      // enable internal pullups
+        I2C_CLK_SRC_DEFAULT,
+        7,          // glitch ignore count
+        PDB_I2C_ASYNC ? PDB_I2C_QUEUE_DEPTH : 0,
     };
-    MCP23017::MCP23017 gpio0{i2c_bus, MCP23017::SubAddress_e::SUBADDR_0};
-    MCP23017::MCP23017 gpio1{i2c_bus, MCP23017::SubAddress_e::SUBADDR_1};
-
-    gpio0.set_ports_direction(0xFF, 0xFF); // all pins as inputs
-    gpio0.set_ports_polarity(0xFF, 0xFF); // inverted polarity
-    gpio0.set_ports_pullups(0xFF, 0xFF); // pull-up resistors enable
-    std::cout << "gpio0 config done." << std::endl;
-    gpio0.set_config(
-        0xFF, 0xFF, // all pins as inputs (default)
-        0xFF, 0xFF, // inverted polarity
-        0xFF, 0xFF); // pull-up resistors enable
-    std::cout << "gpio0 set_config done." << std::endl;
+    Expanders expanders{i2c_bus, 100000UL, -1, PDB_SCAN_INTERRUPT_DRIVEN};
 
-    gpio1.set_config(
+    expanders.set_config(
         0xFF, 0xFF, // all pins as inputs (default)
         0xFF, 0xFF, // inverted polarity
         0xFF, 0xFF); // pull-up resistors enable
-    std::cout << "gpio1 set_config done." << std::endl;
+    boot_mark(BootStep_e::EXPANDERS_CONFIGURED);
+#if PDB_SCAN_PROFILE
+    expanders.measure_scan_time(100);
+#endif
 
-    led.blink(1);
+    led.blink(0);
 
-    usb_itf_install();
-    UsbHostMidiClient usb_midi;
-    usb_midi.activate_pass_through(true);
+    scan_task_hdl = xTaskGetCurrentTaskHandle();
+#if PDB_SCAN_INTERRUPT_DRIVEN
+    expander_int_install();
+    lockout_timer_create();
+#elif PDB_I2C_ASYNC
+    expanders.set_scan_done_callback(expanders_read_done, NULL);
+#endif
 
-    led.blink(0);
+    Contacts contacts_raw{};  // before debounce
+    Contacts contacts_raw_prec{};
+    Contacts contacts_status{};
+    Contacts contacts_status_prec{};
+    static ContactTimes contact_edge_us{};  // last raw edge of each contact
+#if PDB_DUAL_CONTACT
+    static DualContactPedals<PDB_NB_PEDALS> velocity_pedals{pedal_velocity_curve, PDB_MIDI_VELOCITY};
+#endif
 
-    std::vector<uint8_t> gpio_reg{18};
-    std::bitset<30> pedals_status;
-    std::bitset<30> pedals_status_prec;
-    std::bitset<30> note_on_mask;
-    std::bitset<30> note_off_mask;
+    Debouncer<PDB_NB_CONTACTS> debouncer{PDB_DEBOUNCE_SETTLE_US, PDB_DEBOUNCE_TICK_US, esp_timer_get_time()};
+    int64_t stats_time_us = esp_timer_get_time();
 
     bool midi_config_sent = false;
+    bool first_scan_marked = false;  // boot timeline step marked once, not at every scan
 
-    while (true) {
-        // time measurements for performance monitoring
-        const auto start_time = std::chrono::high_resolution_clock::now();
+#if !PDB_SCAN_INTERRUPT_DRIVEN
+    ScanScheduler scheduler{PDB_SCAN_PERIOD_US, PDB_NOTIFY_SCAN_TICK};
+    scheduler.start();
+#endif
+#if CONFIG_PDB_BENCH_SCAN_HEAP
+    const std::array<const char*, 4> other_tasks{pedalboard_tasks.usb_lib.name, pedalboard_tasks.usb_midi.name,
+        pedalboard_tasks.event_log.name, pedalboard_tasks.stats.name};
+    scan_heap_bench(1000, bench_scan, &expanders, other_tasks);
+#endif
+    boot_mark(BootStep_e::SCAN_STARTED);
 
+    while (true) {
+#if PDB_SCAN_INTERRUPT_DRIVEN
+        // wait for a gpio interrupt, the end of the first running pedal lockout,
+        // or a timeout to retry disconnected gpios
+        if (debouncer.busy()){
+            lockout_timer_start(debouncer.unlock_time_us() - esp_timer_get_time());
+        }
+        uint32_t notified = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &notified, pdMS_TO_TICKS(PDB_SCAN_IDLE_TIMEOUT_MS));
+#else
+        // wait for the next scan period
+        scheduler.wait();
+#endif
         // Pedals status update
+        contacts_status_prec = contacts_status;
+        contacts_raw_prec = contacts_raw;
+        std::array<int64_t, PDB_NB_EXPANDERS> int_us{};
+#if PDB_SCAN_INTERRUPT_DRIVEN
+        // only the expander(s) which raised an interrupt are read, with their INT edge time
+        const uint32_t int_pending = expander_int_pending(notified);
+        for (std::size_t e = 0; e < PDB_NB_EXPANDERS; e++){
+            if (int_pending & (1u << e)){
+                int_us[e] = expander_int_us[e].exchange(0, std::memory_order_relaxed);
+            }
+        }
+        contacts_pack(contacts_raw, expanders.scan_interrupts(int_pending));
+#elif PDB_I2C_ASYNC
+        // all expanders reads queued at once, one notification when the last one is done
+        // (a scan tick received meanwhile is kept for the scheduler)
+        if (expanders.scan_async() && !notify_wait_bit(PDB_NOTIFY_I2C_DONE, PDB_I2C_ASYNC_TIMEOUT_US)){
+            expanders.scan_async_timeout();
+        }
+        contacts_pack(contacts_raw, expanders.scan_async_result());
+#else
+        contacts_pack(contacts_raw, expanders.scan());
+#endif
 
-        // GPIO1 (MSB) first
-        pedals_status_prec = pedals_status;
-        if (gpio1.get_status() == MCP23017::Status_e::STS_READY){
-            pedals_status << gpio1.read_ports();
-        } else {
-            gpio1.check_status();
-            pedals_status << 0x00;  // default pedals states if gpio unavailable
+        // Contact bounces filtering
+        const int64_t now_us = esp_timer_get_time();  // pedals read completion
+        contacts_edge_times(expanders, int_us, contacts_raw_prec, contacts_raw, now_us, contact_edge_us);
+        contacts_status = debouncer.update(contacts_raw, now_us);
+        if (!first_scan_marked){
+            boot_mark(BootStep_e::FIRST_SCAN);
+            first_scan_marked = true;
         }
-        // GPIO0 (LSB)
-        if (gpio0.get_status() == MCP23017::Status_e::STS_READY){
-            pedals_status << gpio0.read_ports();
-        } else {
-            gpio0.check_status();
-            pedals_status << 0x00;  // default pedals states if gpio unavailable
+
+        // Scan statistics snapshot, printed by the stats task (skipped while the previous
+        // one is not printed yet : counters kept for the next period)
+        if ((now_us - stats_time_us >= PDB_SCAN_STATS_PERIOD_S * 1000000LL)
+            && !scan_stats_pending.load(std::memory_order_acquire)){
+            stats_time_us = now_us;
+#if !PDB_SCAN_INTERRUPT_DRIVEN
+            scan_stats.period_us = scheduler.period();
+            scan_stats.periods = scheduler.stats();
+            scheduler.reset_stats();
+#endif
+            scan_stats.expanders = expanders.stats();
+            expanders.reset_stats();
+            for (std::size_t p = 0; p < PDB_NB_CONTACTS; p++){
+                scan_stats.bounces[p] = debouncer.bounces(p);
+            }
+            debouncer.reset_stats();
+#if PDB_DUAL_CONTACT
+            scan_stats.missed_early = velocity_pedals.missed_early();
+            velocity_pedals.reset_stats();
+#endif
+            scan_stats_pending.store(true, std::memory_order_release);
+            xTaskNotifyGive(stats_task_hdl);
         }
 
         // Pedals status changed
-        if (pedals_status != pedals_status_prec){
-
-            // note off detection
-            // 0 -> 0 : 0
-            // 0 -> 1 : 0
-            // 1 -> 0 : 1
-            // 1 -> 1 : 0
-            note_off_mask = pedals_status_prec & ~pedals_status;
-
-            // note on detection
-            // 0 -> 0 : 0
-            // 0 -> 1 : 1
-            // 1 -> 0 : 0
-            // 1 -> 1 : 0
-            note_on_mask = ~pedals_status_prec & pedals_status;
+        // note off : 1 -> 0, note on : 0 -> 1 (status XOR previous status)
+        const PedalEdges<PDB_NB_CONTACTS> edges = pedal_edges<PDB_NB_CONTACTS>(contacts_status_prec, contacts_status);
+        if (edges.any){
+            const int64_t edge_us = esp_timer_get_time();
+            latency_record(LatencyStage_e::READ_TO_EDGE, edge_us - now_us);
 
-            if (midi_config_sent){
-                // sending note OFF
-                for (int b=0; b<30; b++){
-                    if (note_off_mask.test(b)){
-                        std::cout << "Note OFF : " << b << std::endl;
-                        usb_midi.send_note(false, PDB_FIRST_MIDI_NOTE + b);
+#if PDB_DUAL_CONTACT
+            // contacts of a pedal visited in order : early (bit 2p) then late (bit 2p + 1)
+            Contacts changed{};
+            for (std::size_t w = 0; w < changed.size(); w++){
+                changed[w] = edges.released[w] | edges.pressed[w];
+            }
+            for_each_set_bit(changed, [&](std::size_t b){
+                const bool closed = (edges.pressed[b / 32] >> (b % 32)) & 1;
+                velocity_pedals.contact(b / 2, b & 1, closed, contact_edge_us[b], [&](const PedalNote& note){
+                    if (midi_config_sent){
+                        send_pedal_note(usb_midi, note, now_us);
                     }
-                }
+                });
+            });
+            if (midi_config_sent){
+                usb_midi.flush();
+                latency_record(LatencyStage_e::EDGE_TO_ENQUEUE, esp_timer_get_time() - edge_us);
+            }
+#else
+            if (midi_config_sent){
+                // sending note OFF, only the changed pedals are visited
+                for_each_set_bit(edges.released, [&](std::size_t b){
+                    event_log(LogEvent_e::NOTE_OFF, b);
+                    usb_midi.send_events(pedal_midi_map.note_off[b].events(), now_us, PDB_MIDI_OUT_DEVICES);
+                });
                 // sending note ON
-                for (int b=0; b<30; b++){
-                    if (note_on_mask.test(b)){
-                        std::cout << "Note ON : " << b << std::endl;
-                        usb_midi.send_note(true, PDB_FIRST_MIDI_NOTE + b);
-                    }
-                }
+                for_each_set_bit(edges.pressed, [&](std::size_t b){
+                    event_log(LogEvent_e::NOTE_ON, b, PDB_MIDI_VELOCITY);
+                    usb_midi.send_events(pedal_midi_map.note_on[b].events(), now_us, PDB_MIDI_OUT_DEVICES);
+                });
                 //usb_midi.send_local_control(note_on);
+                // all the events of this scan sent together
+                usb_midi.flush();
+                latency_record(LatencyStage_e::EDGE_TO_ENQUEUE, esp_timer_get_time() - edge_us);
             }
+#endif
 
-            std::cout << pedals_status << std::endl;
-            const std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start_time;
-            std::cout << "traitement : " << elapsed << std::endl;
+            for (std::size_t w = 0; w < contacts_status.size(); w++){
+                event_log(LogEvent_e::PEDALS, w, contacts_status[w]);
+            }
         }
 
         // USB device status management
@@ -153,6 +586,10 @@ extern "C" void app_main(void)
                 // TODO add usb_midi.send... command...
 
                 midi_config_sent = true;
+                boot_mark(BootStep_e::MIDI_CONFIG_SENT);
+#if CONFIG_PDB_BENCH_GLISSANDO
+                glissando_bench(usb_midi, PDB_NB_PEDALS, pedal_events, PDB_MIDI_OUT_DEVICES);
+#endif
             }
         }
         else
@@ -165,7 +602,5 @@ extern "C" void app_main(void)
                 midi_config_sent = false;
             }
         }
-
-        std::this_thread::sleep_for(10ms);
     }
 }
@@ -0,0 +1,57 @@
+#include <algorithm>
+
+#include "midi_router.hpp"
+
+bool MidiRouter::route(MidiEventPacket& packet) const
+{
+    const uint8_t cin = midi_packet_cin(packet);
+    const uint8_t status = packet[1];
+    // reserved CIN (zero padding of some devices)
+    if (midi_cin_size(cin) == 0){
+        return false;
+    }
+    const uint8_t cable = cable_map[midi_packet_cable(packet)];
+    if (cable == MIDI_ROUTE_DROP){
+        return false;
+    }
+    if ((cin >= 0x8) && (cin <= 0xE)){
+        // channel message (CIN = status >> 4)
+        const uint8_t channel = channel_map[status & 0x0F];
+        if ((drop_channel_msg & (1u << cin)) || (channel == MIDI_ROUTE_DROP)){
+            return false;
+        }
+        packet[1] = (status & 0xF0) | channel;
+    } else if ((cin == 0x4) || (cin == 0x6) || (cin == 0x7) || ((cin == 0x5) && (status == 0xF7))){
+        // system exclusive start / continue / end
+        if (drop_sysex){
+            return false;
+        }
+    } else if (status >= 0xF0){
+        // system common (CIN 0x2, 0x3, 0x5), single byte (CIN 0xF) : real time
+        if (drop_system_msg & (1u << (status & 0x0F))){
+            return false;
+        }
+    }
+    packet[0] = (cable << 4) | cin;
+    return true;
+}
+
+auto midi_route_packets(const MidiRouter& router, std::span<const uint8_t> in, std::span<uint8_t> out) -> MidiRouteResult
+{
+    MidiRouteResult result{0, 0, 0};
+    const MidiPacketReader packets{in};
+    for (std::size_t i = 0; i < packets.size(); i++){
+        MidiEventPacket packet = packets[i];
+        if (router.route(packet)){
+            if (result.nb_written + packet.size() > out.size()){
+                break;  // OUT buffer full, remaining packets not processed
+            }
+            std::copy(packet.begin(), packet.end(), out.begin() + result.nb_written);
+            result.nb_written += packet.size();
+        } else {
+            result.nb_dropped++;
+        }
+        result.nb_read += packet.size();
+    }
+    return result;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "midi_packet.hpp"
+
+// cable / channel map entry : packets of this cable / channel dropped
+#define MIDI_ROUTE_DROP 0xFF
+
+// MIDI IN -> OUT (pass through) routing table, applied packet by packet
+struct MidiRouter{
+    std::array<uint8_t, 16> cable_map;    // input cable -> output cable (or MIDI_ROUTE_DROP)
+    std::array<uint8_t, 16> channel_map;  // channel messages input channel -> output channel (or MIDI_ROUTE_DROP)
+    uint16_t drop_channel_msg;            // bit n : channel messages with status n << 4 dropped (n = 0x8..0xE)
+    uint16_t drop_system_msg;             // bit n : system common / real time messages 0xF0 + n dropped
+    bool drop_sysex;                      // system exclusive streams dropped
+
+    // every packet forwarded unchanged
+    static constexpr auto forward_all(void) -> MidiRouter {
+        MidiRouter router{};
+        for (uint8_t i = 0; i < 16; i++){
+            router.cable_map[i] = i;
+            router.channel_map[i] = i;
+        }
+        return router;
+    }
+
+    // false : packet dropped, otherwise packet remapped in place
+    bool route(MidiEventPacket& packet) const;
+};
+
+// MIDI timing clock, active sensing
+inline constexpr uint16_t MIDI_SYSTEM_CLOCK = 1u << 0x8;
+inline constexpr uint16_t MIDI_SYSTEM_ACTIVE_SENSING = 1u << 0xE;
+
+struct MidiRouteResult{
+    std::size_t nb_read;     // bytes of the IN buffer processed (whole packets)
+    std::size_t nb_written;  // bytes written to the OUT buffer
+    uint32_t nb_dropped;     // packets dropped by the router
+};
+
+// Routes the event packets of in to out, until in is empty or out is full.
+// out may be in itself (in place routing : packets are only removed or rewritten)
+auto midi_route_packets(const MidiRouter& router, std::span<const uint8_t> in, std::span<uint8_t> out) -> MidiRouteResult;
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "midi_packet.hpp"
+
+// USB-MIDI note ON / OFF event packet (cable number, code index number, status, note, velocity)
+constexpr MidiEventPacket midi_note_packet(bool note_on, uint8_t channel, uint8_t note, uint8_t velocity, uint8_t cable = 0)
+{
+    const uint8_t status = static_cast<uint8_t>((note_on ? 0x90 : 0x80) | (channel & 0x0F));
+    return {static_cast<uint8_t>((cable << 4) | (status >> 4)), status, note, velocity};
+}
+
+// pre-encoded events sent on one pedal change
+template<std::size_t MaxEvents>
+struct PedalMidiEvents{
+    std::array<MidiEventPacket, MaxEvents> packets;
+    std::size_t nb;
+
+    constexpr std::span<const MidiEventPacket> events(void) const {return {packets.data(), nb};}
+};
+
+// same events, note ON velocity replaced (velocity sensing pedals)
+template<std::size_t MaxEvents>
+constexpr auto pedal_events_velocity(const PedalMidiEvents<MaxEvents>& events, uint8_t velocity) -> PedalMidiEvents<MaxEvents>
+{
+    PedalMidiEvents<MaxEvents> result = events;
+    for (std::size_t e = 0; e < result.nb; e++){
+        result.packets[e][3] = velocity & 0x7F;
+    }
+    return result;
+}
+
+// pedal (input bit) -> events, built at compile time : the scan loop only looks them up
+template<std::size_t NbPedals, std::size_t MaxEvents>
+struct PedalMidiMap{
+    std::array<PedalMidiEvents<MaxEvents>, NbPedals> note_on;
+    std::array<PedalMidiEvents<MaxEvents>, NbPedals> note_off;
+};
+
+// pedal p plays first_note + p, and the notes at the given intervals (semitones) above it
+template<std::size_t NbPedals, std::size_t NbNotes>
+constexpr auto make_pedal_midi_map(uint8_t first_note, const std::array<uint8_t, NbNotes>& intervals,
+    uint8_t velocity, uint8_t channel = 0) -> PedalMidiMap<NbPedals, NbNotes>
+{
+    PedalMidiMap<NbPedals, NbNotes> map{};
+    for (std::size_t p = 0; p < NbPedals; p++){
+        for (std::size_t n = 0; n < NbNotes; n++){
+            const uint8_t note = static_cast<uint8_t>(first_note + p + intervals[n]);
+            map.note_on[p].packets[n] = midi_note_packet(true, channel, note, velocity);
+            map.note_off[p].packets[n] = midi_note_packet(false, channel, note, velocity);
+        }
+        map.note_on[p].nb = NbNotes;
+        map.note_off[p].nb = NbNotes;
+    }
+    return map;
+}
+
+// every note of the map in the MIDI range (0..127), a note ON / OFF for every pedal
+template<std::size_t NbPedals, std::size_t NbNotes>
+constexpr bool pedal_midi_map_valid(uint8_t first_note, const std::array<uint8_t, NbNotes>& intervals)
+{
+    if ((NbPedals == 0) || (NbNotes == 0)){
+        return false;
+    }
+    for (const uint8_t interval : intervals){
+        if (first_note + NbPedals - 1 + interval > 0x7F){
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "pedal_word.hpp"
+
+// Velocity curve shapes (time between the two contacts -> velocity)
+enum class VelocityShape_e : uint8_t
+{
+    LINEAR,
+    SOFT,   // loud notes need a fast press
+    HARD,   // loud notes even for a moderate press
+};
+
+// Contacts delay -> velocity table : delay <= min_us gives table[0], >= max_us table[NbSteps - 1]
+struct VelocityCurve{
+    static constexpr std::size_t NbSteps = 128;
+
+    uint32_t min_us;
+    uint32_t max_us;
+    std::array<uint8_t, NbSteps> table;
+
+    constexpr uint8_t velocity(int64_t delay_us) const {
+        const int64_t range_us = std::max<int64_t>(int64_t{max_us} - min_us, 1);
+        const int64_t step = (std::clamp<int64_t>(delay_us, min_us, max_us) - min_us) * (NbSteps - 1) / range_us;
+        return table[step];
+    }
+};
+
+// fastest press (min_us) : velocity 127, slowest (max_us) : velocity 1
+constexpr VelocityCurve make_velocity_curve(uint32_t min_us, uint32_t max_us, VelocityShape_e shape = VelocityShape_e::LINEAR)
+{
+    constexpr uint32_t last = VelocityCurve::NbSteps - 1;
+    VelocityCurve curve{min_us, max_us, {}};
+    for (uint32_t i = 0; i <= last; i++){
+        // loudness lost at step i, fixed point 0..last * last
+        uint32_t lost = i * last;
+        if (shape == VelocityShape_e::SOFT){
+            lost = (last * last) - (last - i) * (last - i);
+        } else if (shape == VelocityShape_e::HARD){
+            lost = i * i;
+        }
+        curve.table[i] = static_cast<uint8_t>(127 - (126 * lost + (last * last) / 2) / (last * last));
+    }
+    return curve;
+}
+
+// note on / off produced by the contacts of one pedal
+struct PedalNote{
+    std::size_t pedal;
+    bool note_on;
+    uint8_t velocity;
+    int64_t time_us;    // second contact make / break time
+};
+
+// Two contacts per pedal : early make at the start of the travel, late make at its end.
+// Note on at the late make, velocity from the time elapsed since the early make,
+// note off at the late break. A press stopped before the late contact plays nothing.
+// Contact edges (debounced, with their own timestamps) are given in time order per pedal.
+template<std::size_t NbPedals>
+class DualContactPedals{
+
+public:
+
+    DualContactPedals(const VelocityCurve& curve, uint8_t default_velocity):
+    curve{curve},
+    default_velocity{default_velocity},
+    early_make_us{},
+    early{},
+    sounding{},
+    missed_early_count{0}
+    {}
+
+    // one contact edge, f(const PedalNote&) called when a note starts or ends
+    template<typename F>
+    void contact(std::size_t pedal, bool late, bool closed, int64_t time_us, F&& f){
+        const uint32_t bit = 1u << (pedal % 32);
+        uint32_t& early_word = early[pedal / 32];
+        uint32_t& sounding_word = sounding[pedal / 32];
+        if (!late){
+            if (closed){
+                early_word |= bit;
+                early_make_us[pedal] = time_us;
+            } else {
+                early_word &= ~bit;
+            }
+        } else if (closed && !(sounding_word & bit)){
+            uint8_t velocity = default_velocity;
+            if (early_word & bit){
+                velocity = curve.velocity(time_us - early_make_us[pedal]);
+            } else {
+                missed_early_count++;  // early contact faulty (or edge lost)
+            }
+            sounding_word |= bit;
+            f(PedalNote{pedal, true, velocity, time_us});
+        } else if (!closed && (sounding_word & bit)){
+            sounding_word &= ~bit;
+            f(PedalNote{pedal, false, default_velocity, time_us});
+        }
+    }
+
+    // pedals playing a note
+    const PedalWord<NbPedals>& state(void) const {return sounding;}
+
+    void set_curve(const VelocityCurve& new_curve) {curve = new_curve;}
+    // late contact made without the early one
+    uint32_t missed_early(void) const {return missed_early_count;}
+    void reset_stats(void) {missed_early_count = 0;}
+
+private:
+    VelocityCurve curve;
+    uint8_t default_velocity;
+    std::array<int64_t, NbPedals> early_make_us;
+    PedalWord<NbPedals> early;
+    PedalWord<NbPedals> sounding;
+    uint32_t missed_early_count;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+// Pedals (inputs) states packed in 32 bits words, input i = bit i % 32 of word i / 32
+template<std::size_t NbInputs>
+using PedalWord = std::array<uint32_t, (NbInputs + 31) / 32>;
+
+// store 8 inputs states, byte_index : inputs 8 * byte_index .. 8 * byte_index + 7
+template<std::size_t NbInputs>
+constexpr void pedal_word_set_byte(PedalWord<NbInputs>& word, std::size_t byte_index, uint8_t byte)
+{
+    const std::size_t shift = (byte_index % 4) * 8;
+    uint32_t& w = word[byte_index / 4];
+    w = (w & ~(uint32_t{0xFF} << shift)) | (uint32_t{byte} << shift);
+}
+
+// clear the bits above the last input
+template<std::size_t NbInputs>
+constexpr void pedal_word_mask_unused(PedalWord<NbInputs>& word)
+{
+    if constexpr (NbInputs % 32 != 0){
+        word.back() &= (uint32_t{1} << (NbInputs % 32)) - 1;
+    }
+}
+
+// Calls f(input) for every set bit of mask, in increasing input order.
+// Cost grows with the number of set bits, not with the number of inputs.
+template<std::size_t NbWords, typename F>
+constexpr void for_each_set_bit(const std::array<uint32_t, NbWords>& mask, F&& f)
+{
+    for (std::size_t w = 0; w < NbWords; w++){
+        uint32_t bits = mask[w];
+        while (bits){
+            f(w * 32 + std::countr_zero(bits));
+            bits &= bits - 1;
+        }
+    }
+}
+
+// Pedals changes between two states : released (1 -> 0) and pressed (0 -> 1) inputs
+template<std::size_t NbInputs>
+struct PedalEdges{
+    PedalWord<NbInputs> released;
+    PedalWord<NbInputs> pressed;
+    bool any;
+};
+
+template<std::size_t NbInputs>
+constexpr auto pedal_edges(const PedalWord<NbInputs>& prec, const PedalWord<NbInputs>& state) -> PedalEdges<NbInputs>
+{
+    PedalEdges<NbInputs> edges{};
+    for (std::size_t w = 0; w < prec.size(); w++){
+        const uint32_t changed = prec[w] ^ state[w];
+        edges.released[w] = changed & prec[w];
+        edges.pressed[w] = changed & state[w];
+        edges.any |= (changed != 0);
+    }
+    return edges;
+}
@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cstdlib>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "driver/gptimer.h"
+
+#include "scan_scheduler.hpp"
+
+static const char TAG[] = "pedalboard:scan";
+
+static bool IRAM_ATTR scan_timer_alarm_cb(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *user_ctx)
+{
+    ScanScheduler *scheduler = static_cast<ScanScheduler*>(user_ctx);
+    return scheduler->on_alarm();
+}
+
+ScanScheduler::ScanScheduler(uint32_t period_us, uint32_t notify_bit):
+period_us{period_us},
+notify_bit{notify_bit},
+timer_hdl{NULL},
+task_hdl{NULL},
+ticks{0},
+alarm_time_us{0},
+ticks_seen{0},
+last_wake_us{0},
+period_stats{},
+sum_period_us{0},
+sum_jitter_us{0}
+{
+    const gptimer_config_t timer_config = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = 1000000, // 1 MHz, 1 tick = 1 us
+    };
+    ESP_ERROR_CHECK(gptimer_new_timer(&timer_config, &timer_hdl));
+
+    const gptimer_event_callbacks_t callbacks = {
+        .on_alarm = scan_timer_alarm_cb,
+    };
+    ESP_ERROR_CHECK(gptimer_register_event_callbacks(timer_hdl, &callbacks, static_cast<void*>(this)));
+    ESP_ERROR_CHECK(gptimer_enable(timer_hdl));
+
+    const gptimer_alarm_config_t alarm_config = {
+        .alarm_count = period_us,
+        .reload_count = 0,
+        .flags = {
+            .auto_reload_on_alarm = true,
+        },
+    };
+    ESP_ERROR_CHECK(gptimer_set_alarm_action(timer_hdl, &alarm_config));
+    reset_stats();
+}
+
+ScanScheduler::~ScanScheduler()
+{
+    gptimer_stop(timer_hdl);
+    ESP_ERROR_CHECK_WITHOUT_ABORT(gptimer_disable(timer_hdl));
+    ESP_ERROR_CHECK_WITHOUT_ABORT(gptimer_del_timer(timer_hdl));
+}
+
+void ScanScheduler::start(void)
+{
+    task_hdl = xTaskGetCurrentTaskHandle();
+    ESP_LOGI(TAG, "Scan scheduler started : %lu us period", static_cast<unsigned long>(period_us));
+    ESP_ERROR_CHECK(gptimer_start(timer_hdl));
+}
+
+bool IRAM_ATTR ScanScheduler::on_alarm(void)
+{
+    alarm_time_us.store(esp_timer_get_time(), std::memory_order_relaxed);
+    ticks.fetch_add(1, std::memory_order_release);
+    BaseType_t task_woken = pdFALSE;
+    xTaskNotifyFromISR(task_hdl, notify_bit, eSetBits, &task_woken);
+    return task_woken == pdTRUE;
+}
+
+void ScanScheduler::wait(void)
+{
+    // other notification bits are left pending for their own waiters
+    uint32_t notified = 0;
+    do {
+        xTaskNotifyWait(0, notify_bit, &notified, portMAX_DELAY);
+    } while ((notified & notify_bit) == 0);
+
+    const int64_t now_us = esp_timer_get_time();
+    const uint32_t now_ticks = ticks.load(std::memory_order_acquire);
+    const uint32_t elapsed_ticks = now_ticks - ticks_seen;
+    ticks_seen = now_ticks;
+
+    if (last_wake_us != 0){
+        const int64_t period = now_us - last_wake_us;
+        const int64_t jitter = std::abs(period - static_cast<int64_t>(period_us));
+        period_stats.nb_periods++;
+        period_stats.min_us = std::min(period_stats.min_us, period);
+        period_stats.max_us = std::max(period_stats.max_us, period);
+        period_stats.max_jitter_us = std::max(period_stats.max_jitter_us, jitter);
+        period_stats.max_wake_us = std::max(period_stats.max_wake_us, now_us - alarm_time_us.load(std::memory_order_relaxed));
+        period_stats.missed_ticks += elapsed_ticks - 1;
+        sum_period_us += period;
+        sum_jitter_us += jitter;
+    }
+    last_wake_us = now_us;
+}
+
+auto ScanScheduler::stats(void) const -> ScanPeriodStats
+{
+    ScanPeriodStats result = period_stats;
+    if (result.nb_periods > 0){
+        result.mean_us = sum_period_us / result.nb_periods;
+        result.mean_jitter_us = sum_jitter_us / result.nb_periods;
+    }
+    return result;
+}
+
+void ScanScheduler::reset_stats(void)
+{
+    period_stats = ScanPeriodStats{
+        .nb_periods = 0,
+        .min_us = INT64_MAX,
+        .max_us = 0,
+        .mean_us = 0,
+        .max_jitter_us = 0,
+        .mean_jitter_us = 0,
+        .max_wake_us = 0,
+        .missed_ticks = 0,
+    };
+    sum_period_us = 0;
+    sum_jitter_us = 0;
+}
+
+void ScanScheduler::log_stats(void) const
+{
+    log_stats(period_us, stats());
+}
+
+void ScanScheduler::log_stats(uint32_t period_us, const ScanPeriodStats& s)
+{
+    ESP_LOGI(TAG, "period %lu us : %lu scans, min %lld / mean %lld / max %lld us, jitter mean %lld / max %lld us, wake max %lld us, %lu missed",
+        static_cast<unsigned long>(period_us), static_cast<unsigned long>(s.nb_periods),
+        static_cast<long long>(s.nb_periods ? s.min_us : 0), static_cast<long long>(s.mean_us), static_cast<long long>(s.max_us),
+        static_cast<long long>(s.mean_jitter_us), static_cast<long long>(s.max_jitter_us), static_cast<long long>(s.max_wake_us),
+        static_cast<unsigned long>(s.missed_ticks));
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+
+#include "driver/gptimer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Scan period statistics (microseconds)
+struct ScanPeriodStats{
+    uint32_t nb_periods;
+    int64_t min_us;
+    int64_t max_us;
+    int64_t mean_us;
+    int64_t max_jitter_us;   // max |period - nominal period|
+    int64_t mean_jitter_us;  // mean |period - nominal period|
+    int64_t max_wake_us;     // max timer alarm -> scan task running latency
+    uint32_t missed_ticks;   // timer ticks elapsed while the scan was still running
+};
+
+// Wakes the scan task at a fixed rate from a hardware timer (gptimer) alarm,
+// independently of the FreeRTOS tick, and measures the actual scan period.
+class ScanScheduler{
+
+public:
+
+    ScanScheduler(uint32_t period_us, uint32_t notify_bit);
+    ~ScanScheduler();
+
+    ScanScheduler(const ScanScheduler&) = delete;
+    ScanScheduler& operator=(const ScanScheduler&) = delete;
+
+    // to be called by the scan task
+    void start(void);
+    void wait(void);
+
+    auto stats(void) const -> ScanPeriodStats;
+    void reset_stats(void);
+    void log_stats(void) const;
+    // statistics snapshot logged by another (low priority) task
+    static void log_stats(uint32_t period_us, const ScanPeriodStats& stats);
+    uint32_t period(void) const {return period_us;}
+
+    // called by the timer ISR
+    bool on_alarm(void);
+
+private:
+    const uint32_t period_us;
+    const uint32_t notify_bit;
+    gptimer_handle_t timer_hdl;
+    TaskHandle_t task_hdl;
+
+    // written by the ISR
+    std::atomic<uint32_t> ticks;
+    std::atomic<int64_t> alarm_time_us;
+
+    // written by the scan task
+    uint32_t ticks_seen;
+    int64_t last_wake_us;
+    ScanPeriodStats period_stats;
+    int64_t sum_period_us;
+    int64_t sum_jitter_us;
+};
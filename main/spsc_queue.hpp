@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Single producer / single consumer lock-free ring buffer.
+// Fixed size, no allocation : push() from one task, pop() from another.
+// stage() + commit() publish a batch of items to the consumer at once.
+template<typename T, std::size_t N>
+class SpscQueue{
+    static_assert((N != 0) && ((N & (N - 1)) == 0), "SpscQueue size must be a power of 2");
+
+    std::array<T, N> m_items;
+    std::atomic<std::size_t> m_head; // next write index (producer), free running
+    std::atomic<std::size_t> m_tail; // next read index (consumer), free running
+    std::size_t m_staged;            // next staged index (producer only), not visible yet
+    // statistics (written by the producer)
+    std::atomic<std::size_t> m_high_water;
+    std::atomic<uint32_t> m_drops;
+
+public:
+    SpscQueue(): m_items{}, m_head{0}, m_tail{0}, m_staged{0}, m_high_water{0}, m_drops{0} {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // producer side : false (and item dropped) if the queue is full
+    bool push(const T& item){
+        const bool pushed = stage(item);
+        commit();
+        return pushed;
+    }
+
+    // producer side : item stored but only visible to the consumer after commit()
+    bool stage(const T& item){
+        const std::size_t used = m_staged - m_tail.load(std::memory_order_acquire);
+        if (used >= N){
+            m_drops.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        m_items[m_staged & (N - 1)] = item;
+        m_staged++;
+        if (used + 1 > m_high_water.load(std::memory_order_relaxed)){
+            m_high_water.store(used + 1, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    // producer side : publish the staged items
+    void commit(void){
+        m_head.store(m_staged, std::memory_order_release);
+    }
+
+    // consumer side : false if the queue is empty
+    bool pop(T& item){
+        const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_acquire)){
+            return false;
+        }
+        item = m_items[tail & (N - 1)];
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side : oldest item copied but kept in the queue, false if the queue is empty
+    bool peek(T& item) const{
+        const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_acquire)){
+            return false;
+        }
+        item = m_items[tail & (N - 1)];
+        return true;
+    }
+
+    bool empty(void) const {return size() == 0;}
+    std::size_t size(void) const {
+        // tail first : head can only move forward meanwhile
+        const std::size_t tail = m_tail.load(std::memory_order_acquire);
+        return m_head.load(std::memory_order_acquire) - tail;
+    }
+    static constexpr std::size_t capacity(void) {return N;}
+    std::size_t high_water(void) const {return m_high_water.load(std::memory_order_relaxed);}
+    uint32_t drops(void) const {return m_drops.load(std::memory_order_relaxed);}
+};
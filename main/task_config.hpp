@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// core affinity unset on single core targets (options hidden)
+#ifndef CONFIG_PDB_USB_LIB_TASK_CORE
+#define CONFIG_PDB_USB_LIB_TASK_CORE -1
+#endif
+#ifndef CONFIG_PDB_USB_MIDI_TASK_CORE
+#define CONFIG_PDB_USB_MIDI_TASK_CORE -1
+#endif
+#ifndef CONFIG_PDB_EVENT_LOG_TASK_CORE
+#define CONFIG_PDB_EVENT_LOG_TASK_CORE -1
+#endif
+#ifndef CONFIG_PDB_STATS_TASK_CORE
+#define CONFIG_PDB_STATS_TASK_CORE -1
+#endif
+
+// Creation parameters of one task (same fields as esp_pthread_cfg_t)
+struct TaskConfig{
+    const char *name;
+    uint32_t stack_size;  // bytes
+    UBaseType_t priority;
+    int core_id;          // -1 : no affinity
+
+    BaseType_t create(TaskFunction_t function, void *arg, TaskHandle_t *hdl = NULL) const {
+        return xTaskCreatePinnedToCore(function, name, stack_size, arg, priority, hdl,
+            (core_id < 0) ? tskNO_AFFINITY : static_cast<BaseType_t>(core_id));
+    }
+};
+
+// Every pedalboard task, defaults from menuconfig ("MIDI pedalboard tasks")
+struct PedalboardTasks{
+    UBaseType_t scan_priority;  // app_main task, its core is ESP_MAIN_TASK_AFFINITY
+    TaskConfig usb_lib;
+    TaskConfig usb_midi;
+    TaskConfig event_log;
+    TaskConfig stats;
+};
+
+constexpr PedalboardTasks pedalboard_tasks_default(void)
+{
+    return PedalboardTasks{
+        .scan_priority = CONFIG_PDB_SCAN_TASK_PRIORITY,
+        .usb_lib = {"usb_lib", CONFIG_PDB_USB_LIB_TASK_STACK_SIZE, CONFIG_PDB_USB_LIB_TASK_PRIORITY, CONFIG_PDB_USB_LIB_TASK_CORE},
+        .usb_midi = {"usb_midi", CONFIG_PDB_USB_MIDI_TASK_STACK_SIZE, CONFIG_PDB_USB_MIDI_TASK_PRIORITY, CONFIG_PDB_USB_MIDI_TASK_CORE},
+        .event_log = {"event_log", CONFIG_PDB_EVENT_LOG_TASK_STACK_SIZE, CONFIG_PDB_EVENT_LOG_TASK_PRIORITY, CONFIG_PDB_EVENT_LOG_TASK_CORE},
+        .stats = {"stats", CONFIG_PDB_STATS_TASK_STACK_SIZE, CONFIG_PDB_STATS_TASK_PRIORITY, CONFIG_PDB_STATS_TASK_CORE},
+    };
+}
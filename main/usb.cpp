@@ -24,7 +24,7 @@ void usb_host_lib_daemon_task(void *arg)
     }
 }
 
-void usb_itf_install(void){
+void usb_itf_install(const TaskConfig& task_config){
 
     //Install USB Host driver. Should only be called once in entire application
     ESP_LOGI(TAG, "Installing USB Host");
@@ -35,5 +35,5 @@ void usb_itf_install(void){
     ESP_ERROR_CHECK(usb_host_install(&host_config));
 
     // Create a task that will handle USB library events
-    xTaskCreate(usb_host_lib_daemon_task, "usb_lib", 4096, NULL, 10, NULL);
+    task_config.create(usb_host_lib_daemon_task, NULL);
 }
@@ -1,3 +1,5 @@
 #pragma once
 
-void usb_itf_install(void);
+#include "task_config.hpp"
+
+void usb_itf_install(const TaskConfig& task_config);
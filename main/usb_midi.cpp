@@ -1,38 +1,52 @@
 
 #include <string.h>
+#include <algorithm>
+#include <bit>
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "esp_timer.h"
 #include "usb/usb_host.h"  // USB Host library
 
 #include "usb_midi.hpp"
+#include "latency_stats.hpp"
+#include "event_log.hpp"
+#include "boot_timeline.hpp"
 
 static const char TAG[] = "pedalboard:usb_midi";
 
 // bit mask for each action
 #define MIDI_CLASS_DRIVER_ACTION_OPEN_DEV     0x01
 #define MIDI_CLASS_DRIVER_ACTION_CLOSE_DEV    0x02
-#define MIDI_CLASS_DRIVER_ACTION_TRANSFER_OUT 0x04
-#define MIDI_CLASS_DRIVER_ACTION_TRANSFER_IN  0x08
 
 static void usb_host_midi_client_event_cb(const usb_host_client_event_msg_t *event_msg, void *arg);
 static void usb_client_midi_out_transfer_cb(usb_transfer_t *transfer);
 static void usb_client_midi_in_transfer_cb(usb_transfer_t *transfer);
 
-UsbHostMidiClient::UsbHostMidiClient():
+UsbHostMidiClient::UsbHostMidiClient(const TaskConfig& task_config):
 task_hdl{NULL},
 actions{0},
-dev_addr{0},
 client_hdl{NULL},
-dev_hdl{NULL},
-midi_intf_desc{NULL},
-midi_in_ep_desc{NULL},
-midi_out_ep_desc{NULL},
-in_xfer{NULL},
-out_xfer{NULL},
-pass_through_on{false}
+devices{},
+open_devices{0},
+pass_through_on{false},
+thru_router{MidiRouter::forward_all()},
+thru_forwarded_count{0},
+thru_dropped_count{0},
+out_queue{},
+out_next_token{0},
+out_done_callback{NULL},
+out_done_callback_arg{NULL},
+out_transfer_count{0},
+out_event_count{0},
+out_max_events{MIDI_OUT_XFER_MAX_EVENTS}
 {
-    install();
+    for (std::size_t d = 0; d < devices.size(); d++){
+        devices[d].client = this;
+        devices[d].index = d;
+        devices[d].thru_devices = 1u << d;  // pass through back to the sending device
+    }
+    install(task_config);
 }
 
 UsbHostMidiClient::~UsbHostMidiClient()
@@ -46,13 +60,13 @@ void usb_host_midi_client_task(void *arg)
     midi_client_p->task_loop();
 }
 
-void UsbHostMidiClient::install(void){
+void UsbHostMidiClient::install(const TaskConfig& task_config){
 
     ESP_LOGD(TAG, "Installing MIDI class driver");
     //ESP_ERROR_CHECK(midi_acd_host_install());
 
     // Create a task that will handle USB midi client events
-    xTaskCreate(usb_host_midi_client_task, "usb_midi", 4096, static_cast<void*>(this), 10, &task_hdl);
+    task_config.create(usb_host_midi_client_task, static_cast<void*>(this), &task_hdl);
 }
 
 static void usb_host_midi_client_event_cb(const usb_host_client_event_msg_t *event_msg, void *arg)
@@ -66,17 +80,27 @@ void UsbHostMidiClient::handle_event(const usb_host_client_event_msg_t *event_ms
 {
     ESP_LOGD(TAG, "Handling event %d", event_msg->event);
     switch (event_msg->event) {
-        case USB_HOST_CLIENT_EVENT_NEW_DEV:
-            if (dev_addr == 0) {
-                dev_addr = event_msg->new_dev.address;
-                //Open the device next
-                actions |= MIDI_CLASS_DRIVER_ACTION_OPEN_DEV;
+        case USB_HOST_CLIENT_EVENT_NEW_DEV: {
+            // first free slot of the devices table
+            auto dev = std::find_if(devices.begin(), devices.end(), [](const MidiDevice& d){return d.dev_addr == 0;});
+            if (dev == devices.end()) {
+                ESP_LOGW(TAG, "Device at address %d ignored : %d devices already open", event_msg->new_dev.address, MIDI_MAX_DEVICES);
+                break;
             }
+            dev->dev_addr = event_msg->new_dev.address;
+            dev->open_pending = true;
+            //Open the device next
+            post_action(MIDI_CLASS_DRIVER_ACTION_OPEN_DEV);
             break;
+        }
         case USB_HOST_CLIENT_EVENT_DEV_GONE:
-            if (dev_hdl != NULL) {
-                //Cancel any other actions and close the device next
-                actions = MIDI_CLASS_DRIVER_ACTION_CLOSE_DEV;
+            for (MidiDevice& dev : devices) {
+                if ((dev.dev_hdl != NULL) && (dev.dev_hdl == event_msg->dev_gone.dev_hdl)) {
+                    //Close the device next
+                    //(IN / OUT completions still reported : their transfers return to the pool)
+                    dev.close_pending = true;
+                    post_action(MIDI_CLASS_DRIVER_ACTION_CLOSE_DEV);
+                }
             }
             break;
         default:
@@ -114,42 +138,79 @@ void UsbHostMidiClient::task_loop(void)
     //This is function is called from within usb_host_client_handle_events(). Don't block and try to keep it short
     ESP_LOGD(TAG, "Entering event handling loop");
     while (1) {
-        ESP_LOGD(TAG, "New loop with action %d", actions);
-        if (actions == 0) {
-            usb_host_client_handle_events(client_hdl, portMAX_DELAY);
-            ESP_LOGD(TAG, "usb_host_client_handle_events unblocked with actions %d", actions);
+        // all the posted actions taken at once : the ones posted meanwhile are kept for the next loop
+        const uint8_t pending = actions.exchange(0);
+        ESP_LOGD(TAG, "New loop with actions %d", pending);
+        if (pending == 0) {
+            // packets held by an unfinished SysEx message : woken up to end it after the hold time
+            const bool holding = std::any_of(devices.begin(), devices.end(), [](const MidiDevice& dev){return dev.merger.holding();});
+            // or scan loop events waiting for room in a merge lane : dropped after MIDI_OUT_WAIT_US
+            TickType_t timeout = portMAX_DELAY;
+            if (!out_queue.empty()){
+                timeout = pdMS_TO_TICKS(MIDI_OUT_WAIT_US / 1000) + 1;
+            } else if (holding){
+                timeout = pdMS_TO_TICKS(MIDI_SYSEX_HOLD_US / 1000) + 1;
+            }
+            usb_host_client_handle_events(client_hdl, timeout);
+            ESP_LOGD(TAG, "usb_host_client_handle_events unblocked with actions %d", actions.load());
         } else {
-            if (actions & MIDI_CLASS_DRIVER_ACTION_OPEN_DEV) {
+            if (pending & MIDI_CLASS_DRIVER_ACTION_OPEN_DEV) {
                 action_open_dev();
-                actions &= ~MIDI_CLASS_DRIVER_ACTION_OPEN_DEV;
             }
-            if (actions & MIDI_CLASS_DRIVER_ACTION_CLOSE_DEV) {
+            if (pending & MIDI_CLASS_DRIVER_ACTION_CLOSE_DEV) {
                 action_close_dev();
-                actions &= ~MIDI_CLASS_DRIVER_ACTION_CLOSE_DEV;
-            }
-            if (actions & MIDI_CLASS_DRIVER_ACTION_TRANSFER_OUT) {
-                action_transfert_out();
-                actions &= ~MIDI_CLASS_DRIVER_ACTION_TRANSFER_OUT;
-            }
-            if (actions & MIDI_CLASS_DRIVER_ACTION_TRANSFER_IN) {
-                action_transfert_in();
-                actions &= ~MIDI_CLASS_DRIVER_ACTION_TRANSFER_IN;
             }
         }
+        // MIDI OUT events queued by the scan loop, then each device sends its own events
+        // (also after the transfer callbacks : the OUT transfers they freed are reused here)
+        dispatch_out_events();
+        for (MidiDevice& dev : devices) {
+            send_pending_events(dev);
+        }
     }
     ESP_LOGI(TAG, "Exiting event handling loop");
 }
 
+// Post an action for the USB task (callbacks or other tasks). From another task,
+// the USB task is woken up at once instead of at the next USB host event
+void UsbHostMidiClient::post_action(uint8_t action, uint8_t cancel)
+{
+    if (cancel != 0){
+        actions.fetch_and(static_cast<uint8_t>(~cancel));
+    }
+    actions.fetch_or(action);
+    if ((client_hdl != NULL) && (xTaskGetCurrentTaskHandle() != task_hdl)){
+        usb_host_client_unblock(client_hdl);
+    }
+}
+
 void UsbHostMidiClient::action_open_dev(void)
 {
-    assert(dev_addr != 0);
-    ESP_LOGI(TAG, "Opening device at address %d", dev_addr);
-    ESP_ERROR_CHECK(usb_host_device_open(client_hdl, dev_addr, &dev_hdl));
+    for (MidiDevice& dev : devices) {
+        if (dev.open_pending) {
+            dev.open_pending = false;
+            open_device(dev);
+        }
+    }
+}
+
+void UsbHostMidiClient::open_device(MidiDevice& dev)
+{
+    assert(dev.dev_addr != 0);
+    ESP_LOGI(TAG, "Opening device at address %d (slot %d)", dev.dev_addr, dev.index);
+    if (usb_host_device_open(client_hdl, dev.dev_addr, &dev.dev_hdl) != ESP_OK) {
+        // gone before being opened
+        ESP_LOGW(TAG, "Device at address %d not opened", dev.dev_addr);
+        dev.dev_hdl = NULL;
+        dev.dev_addr = 0;
+        return;
+    }
+    boot_mark(BootStep_e::USB_DEVICE_OPENED);
 
     // get device info : usefull ?
     ESP_LOGI(TAG, "Getting device information");
     usb_device_info_t dev_info;
-    ESP_ERROR_CHECK(usb_host_device_info(dev_hdl, &dev_info));
+    ESP_ERROR_CHECK(usb_host_device_info(dev.dev_hdl, &dev_info));
     ESP_LOGI(TAG, "\t%s speed", (dev_info.speed == USB_SPEED_LOW) ? "Low" : "Full");
     ESP_LOGI(TAG, "\tbConfigurationValue %d", dev_info.bConfigurationValue);
     if (dev_info.str_desc_manufacturer) {
@@ -163,20 +224,18 @@ void UsbHostMidiClient::action_open_dev(void)
     // check device descriptor
     ESP_LOGI(TAG, "Getting device descriptor");
     const usb_device_desc_t *dev_desc;
-    ESP_ERROR_CHECK(usb_host_get_device_descriptor(dev_hdl, &dev_desc));
+    ESP_ERROR_CHECK(usb_host_get_device_descriptor(dev.dev_hdl, &dev_desc));
     usb_print_device_descriptor(dev_desc);
-    // check something ?
-    assert(dev_desc->bDeviceClass == USB_CLASS_PER_INTERFACE);
 
     // check config descriptor
     ESP_LOGI(TAG, "Getting device configuration descriptor");
     const usb_config_desc_t *config_desc;
     const usb_intf_desc_t *intf_desc;
     int desc_offset;
-    ESP_ERROR_CHECK(usb_host_get_active_config_descriptor(dev_hdl, &config_desc));
+    ESP_ERROR_CHECK(usb_host_get_active_config_descriptor(dev.dev_hdl, &config_desc));
     usb_print_config_descriptor(config_desc, NULL);
-    // Go through all config's interfaces and parse
-    for (int i = 0; i < config_desc->bNumInterfaces; i++) {
+    // Go through all config's interfaces and parse (other class devices, e.g. a hub, have none)
+    for (int i = 0; (i < config_desc->bNumInterfaces) && (dev_desc->bDeviceClass == USB_CLASS_PER_INTERFACE); i++) {
         ESP_LOGD(TAG, "Parsing interface #%d", i);
         intf_desc = usb_parse_interface_descriptor(config_desc, i, 0, &desc_offset);
 
@@ -184,13 +243,15 @@ void UsbHostMidiClient::action_open_dev(void)
         // bInterfaceClass 0x1 // AUDIO
         // bInterfaceSubClass 0x3 // MIDISTREAMING
         // bInterfaceProtocol 0x0 // PR_PROTOCOL_UNDEFINED
-        if ((intf_desc->bInterfaceClass == 0x1) // USB_CLASS_AUDIO
+        // (first MIDI Streaming interface of the device only)
+        if ((intf_desc != NULL) and (dev.intf_desc == NULL)
+        and (intf_desc->bInterfaceClass == 0x1) // USB_CLASS_AUDIO
         and (intf_desc->bInterfaceSubClass == 0x3))
         {
             ESP_LOGI(TAG, "MIDI Streaming interface found (interface #%d)", intf_desc->bInterfaceNumber);
             // if ok, claim interface
-            ESP_ERROR_CHECK(usb_host_interface_claim(client_hdl, dev_hdl, intf_desc->bInterfaceNumber, 0));
-            midi_intf_desc = intf_desc;
+            ESP_ERROR_CHECK(usb_host_interface_claim(client_hdl, dev.dev_hdl, intf_desc->bInterfaceNumber, 0));
+            dev.intf_desc = intf_desc;
 
             const int temp_offset = desc_offset; // Save this offset for later
             // Go through all interface's endpoints and parse Interrupt and Bulk endpoints
@@ -201,101 +262,152 @@ void UsbHostMidiClient::action_open_dev(void)
                 if (USB_EP_DESC_GET_XFERTYPE(this_ep) == USB_TRANSFER_TYPE_BULK) {
                     if (USB_EP_DESC_GET_EP_DIR(this_ep))
                     {
-                        ESP_LOGI(TAG, "Endpoint %d  IN", USB_EP_DESC_GET_EP_NUM(this_ep));
-                        midi_in_ep_desc = this_ep;
-
-                        // Setup IN data transfer
-                        usb_host_transfer_alloc(USB_EP_DESC_GET_MPS(midi_in_ep_desc), 0, &in_xfer);
-                        assert(in_xfer);
-                        in_xfer->num_bytes = USB_EP_DESC_GET_MPS(midi_in_ep_desc);
-                        in_xfer->bEndpointAddress = midi_in_ep_desc->bEndpointAddress;
-                        in_xfer->device_handle = dev_hdl;
-                        in_xfer->callback = usb_client_midi_in_transfer_cb;
-                        in_xfer->context = static_cast<void*>(this);
+                        ESP_LOGI(TAG, "Endpoint %d  IN (MPS %d)", USB_EP_DESC_GET_EP_NUM(this_ep), USB_EP_DESC_GET_MPS(this_ep));
+                        dev.in_ep_desc = this_ep;
                     }
                     else
                     {
-                        ESP_LOGI(TAG, "Endpoint %d  OUT", USB_EP_DESC_GET_EP_NUM(this_ep));
-                        midi_out_ep_desc = this_ep;
-
-                        // Setup OUT data transfer
-                        usb_host_transfer_alloc(USB_EP_DESC_GET_MPS(midi_out_ep_desc), 0, &out_xfer);
-                        assert(out_xfer);
-                        out_xfer->num_bytes = USB_EP_DESC_GET_MPS(midi_out_ep_desc);
-                        out_xfer->bEndpointAddress = midi_out_ep_desc->bEndpointAddress;
-                        out_xfer->device_handle = dev_hdl;
-                        out_xfer->callback = usb_client_midi_out_transfer_cb;
-                        out_xfer->context = static_cast<void*>(this);
+                        ESP_LOGI(TAG, "Endpoint %d  OUT (MPS %d)", USB_EP_DESC_GET_EP_NUM(this_ep), USB_EP_DESC_GET_MPS(this_ep));
+                        dev.out_ep_desc = this_ep;
                     }
                 }
                 desc_offset = temp_offset;
             }
         }
-        else
-        {
-            // else RAZ
-            midi_intf_desc = NULL;
-        }
     }
 
-    if (midi_intf_desc == NULL) // no appropriate interface found in this device
+    if (dev.intf_desc == NULL) // no appropriate interface found in this device
     {
-        ESP_LOGI(TAG, "No MIDI Streaming interface found on device at address %d", dev_addr);
-        action_close_dev();
+        ESP_LOGI(TAG, "No MIDI Streaming interface found on device at address %d", dev.dev_addr);
+        close_device(dev);
     }
     else // MIDI interface found
     {
-        arm_transfert_in();
+        alloc_transfers(dev);
+        open_devices.fetch_or(1u << dev.index);
+        arm_transfert_in(dev);
+        boot_mark(BootStep_e::USB_MIDI_READY);
+    }
+}
+
+// Setup the IN / OUT data transfers pool of a device : buffers large enough for both endpoints
+void UsbHostMidiClient::alloc_transfers(MidiDevice& dev)
+{
+    const std::size_t in_mps = (dev.in_ep_desc != NULL) ? USB_EP_DESC_GET_MPS(dev.in_ep_desc) : 0;
+    const std::size_t out_mps = (dev.out_ep_desc != NULL) ? USB_EP_DESC_GET_MPS(dev.out_ep_desc) : 0;
+    for (auto& xfer : dev.xfers){
+        usb_host_transfer_alloc(std::max(in_mps, out_mps), 0, &xfer.xfer);
+        assert(xfer.xfer);
+        xfer.device = &dev;
+        xfer.xfer->device_handle = dev.dev_hdl;
+        xfer.xfer->context = static_cast<void*>(&xfer);
+        dev.xfers_free[dev.xfers_free_count++] = &xfer;
+    }
+}
+
+void UsbHostMidiClient::free_transfers(MidiDevice& dev)
+{
+    for (auto& xfer : dev.xfers){
+        usb_host_transfer_free(xfer.xfer);
+        xfer.xfer = NULL;
+    }
+    dev.xfers_free_count = 0;
+    dev.in_xfers_armed = 0;
+}
+
+MidiTransfer *UsbHostMidiClient::get_transfer(MidiDevice& dev)
+{
+    return (dev.xfers_free_count > 0) ? dev.xfers_free[--dev.xfers_free_count] : NULL;
+}
+
+// back to the pool of its device
+void UsbHostMidiClient::put_transfer(MidiTransfer *xfer)
+{
+    MidiDevice& dev = *xfer->device;
+    dev.xfers_free[dev.xfers_free_count++] = xfer;
+    if (dev.closing && (dev.xfers_free_count == dev.xfers.size())){
+        // last in flight transfer of a closing device : the interface can be released
+        dev.close_pending = true;
+        post_action(MIDI_CLASS_DRIVER_ACTION_CLOSE_DEV);
     }
 }
 
 
 
 bool UsbHostMidiClient::connected(void){
-    return midi_intf_desc != NULL;
+    return open_devices.load() != 0;
+}
+
+std::size_t UsbHostMidiClient::nb_devices(void) const
+{
+    return std::popcount(open_devices.load());
 }
 
 void UsbHostMidiClient::action_close_dev(void)
 {
-    if (midi_intf_desc != NULL)
+    for (MidiDevice& dev : devices) {
+        if (dev.close_pending) {
+            dev.close_pending = false;
+            close_device(dev);
+        }
+    }
+}
+
+void UsbHostMidiClient::close_device(MidiDevice& dev)
+{
+    open_devices.fetch_and(static_cast<uint8_t>(~(1u << dev.index)));
+    if (dev.intf_desc != NULL)
     {
-        ESP_LOGI(TAG, "Releasing interface %d", midi_intf_desc->bInterfaceNumber);
-        ESP_ERROR_CHECK(usb_host_interface_release(client_hdl, dev_hdl, midi_intf_desc->bInterfaceNumber));
-        midi_intf_desc = NULL;
-        midi_in_ep_desc = NULL;
-        midi_out_ep_desc = NULL;
-        
-        usb_host_transfer_free(in_xfer);
-        in_xfer = NULL;
+        if (!dev.closing){
+            // no transfer submitted from now on, the in flight ones cancelled
+            dev.closing = true;
+            halt_endpoint(dev, dev.in_ep_desc);
+            halt_endpoint(dev, dev.out_ep_desc);
+        }
+        if (dev.xfers_free_count < dev.xfers.size()){
+            // closed again by put_transfer() when the last transfer is back in the pool
+            ESP_LOGD(TAG, "Closing slot %d : %u transfers in flight", dev.index, static_cast<unsigned>(dev.xfers.size() - dev.xfers_free_count));
+            return;
+        }
+        ESP_LOGI(TAG, "Releasing interface %d", dev.intf_desc->bInterfaceNumber);
+        ESP_ERROR_CHECK(usb_host_interface_release(client_hdl, dev.dev_hdl, dev.intf_desc->bInterfaceNumber));
+        dev.intf_desc = NULL;
+        dev.in_ep_desc = NULL;
+        dev.out_ep_desc = NULL;
+
+        free_transfers(dev);
+        dev.closing = false;
+    }
+    // discard the events queued for this device
+    dev.merger.clear();
+
+    ESP_LOGI(TAG, "Closing device at address %d (slot %d)", dev.dev_addr, dev.index);
+    ESP_ERROR_CHECK(usb_host_device_close(client_hdl, dev.dev_hdl));
+    dev.dev_hdl = NULL;
+    dev.dev_addr = 0;
+}
 
-        usb_host_transfer_free(out_xfer);
-        out_xfer = NULL;
+// transfers of the endpoint completed as canceled (no device : already halted and flushed by the host library)
+void UsbHostMidiClient::halt_endpoint(MidiDevice& dev, const usb_ep_desc_t *ep_desc)
+{
+    if (ep_desc == NULL){
+        return;
+    }
+    const esp_err_t err = usb_host_endpoint_halt(dev.dev_hdl, ep_desc->bEndpointAddress);
+    if ((err != ESP_OK) || (usb_host_endpoint_flush(dev.dev_hdl, ep_desc->bEndpointAddress) != ESP_OK)){
+        ESP_LOGD(TAG, "Endpoint 0x%02x not flushed (slot %d)", ep_desc->bEndpointAddress, dev.index);
     }
-    
-    ESP_LOGI(TAG, "Closing device");
-    ESP_ERROR_CHECK(usb_host_device_close(client_hdl, dev_hdl));
-    dev_hdl = NULL;
-    dev_addr = 0;
 }
 
 
 
-void UsbHostMidiClient::send_note(bool note_on, uint8_t note)
+void UsbHostMidiClient::send_note(bool note_on, uint8_t note, int64_t origin_us)
 {
     if (connected()){
         ESP_LOGD(TAG, "send_note %d %s", note, note_on ? "ON" : "OFF");
-        out_xfer->num_bytes = 8;
-        out_xfer->data_buffer[0] = 0x08; // delta time
-        out_xfer->data_buffer[1] = note_on ? 0x90 : 0x80; // Status : Note ON / OFF
-        out_xfer->data_buffer[2] = note; // note
-        out_xfer->data_buffer[3] = 0x40; // Velocity 64/127
-
-        out_xfer->data_buffer[4] = 0x08; // delta time
-        out_xfer->data_buffer[5] = note_on ? 0x90 : 0x80; // Status : Note ON / OFF
-        out_xfer->data_buffer[6] = note+7; // note
-        out_xfer->data_buffer[7] = 0x40; // Velocity 64/127
-
-        submit_midi_transfert_out();
+        const uint8_t status = note_on ? 0x90 : 0x80; // Status : Note ON / OFF
+        const uint8_t cin = status >> 4; // cable 0, code index number
+        send_async({cin, status, note, 0x40}, origin_us); // Velocity 64/127
     }
     else
     {
@@ -303,17 +415,25 @@ void UsbHostMidiClient::send_note(bool note_on, uint8_t note)
     }
 }
 
+void UsbHostMidiClient::send_events(std::span<const MidiEventPacket> packets, int64_t origin_us, uint8_t devices)
+{
+    if (connected()){
+        for (const MidiEventPacket& packet : packets){
+            send_async(packet, origin_us, devices);
+        }
+    }
+    else
+    {
+        ESP_LOGW(TAG, "send_events : No MIDI device connected");
+    }
+}
+
 void UsbHostMidiClient::send_local_control(bool local_ctrl_on)
 {
     if (connected()){
         ESP_LOGD(TAG, "local_control %s", local_ctrl_on ? "ON" : "OFF");
-        out_xfer->num_bytes = 4;
-        out_xfer->data_buffer[0] = 0x08; // delta time
-        out_xfer->data_buffer[1] = 0xB0; // Status : Local control
-        out_xfer->data_buffer[2] = 0x7A;
-        out_xfer->data_buffer[3] = local_ctrl_on ? 0x7F : 0x00; // Local ON / OFF
-
-        submit_midi_transfert_out();
+        // Status : Local control, Local ON / OFF
+        send_async({0x0B, 0xB0, 0x7A, static_cast<uint8_t>(local_ctrl_on ? 0x7F : 0x00)});
     }
     else
     {
@@ -321,81 +441,241 @@ void UsbHostMidiClient::send_local_control(bool local_ctrl_on)
     }
 }
 
-void UsbHostMidiClient::submit_midi_transfert_out(void)
+// called by the scan loop (producer) : never touches the USB stack.
+// Events are only sent after flush()
+uint32_t UsbHostMidiClient::send_async(const MidiEventPacket& packet, int64_t origin_us, uint8_t devices)
 {
-//    ESP_LOGI(TAG, "Submitting OUT transfert");
-    //Send an OUT transfer to EP1
-    usb_host_transfer_submit(out_xfer);
-    // TODO : block until OUT transfert done
-    printf("MIDI OUT : ");
-    for (int i = 0; i < out_xfer->num_bytes; ++i){
-        printf("%02X ", out_xfer->data_buffer[i]);
+    // token 0 reserved for "no event"
+    const uint32_t token = (out_next_token == UINT32_MAX) ? 1 : out_next_token + 1;
+    const int64_t now_us = esp_timer_get_time();
+    if (!out_queue.stage({packet, token, origin_us ? origin_us : now_us, now_us, devices})){
+        event_log(LogEvent_e::MIDI_OUT_DROPPED, event_log_packet(packet.data()));
+        return 0;
     }
-    printf(" (%d bytes)\n", out_xfer->num_bytes);
+    out_next_token = token;
+    return token;
 }
 
-static void usb_client_midi_out_transfer_cb(usb_transfer_t *transfer)
+void UsbHostMidiClient::set_out_done_callback(MidiOutDoneCallback callback, void *arg)
 {
-    //This is function is called from within usb_host_client_handle_events(). Don't block and try to keep it short
-    UsbHostMidiClient *midi_client_p = static_cast<UsbHostMidiClient*>(transfer->context);
-    midi_client_p->handle_midi_out_transfert(transfer);
+    out_done_callback_arg = arg;
+    out_done_callback = callback;
 }
 
-void UsbHostMidiClient::handle_midi_out_transfert(usb_transfer_t *transfer)
+// called by the scan loop at the end of each scan : the events of the scan are
+// handed over at once, so that they can be batched in as few transfers as possible
+void UsbHostMidiClient::flush(void)
 {
-    //ESP_LOGI(TAG, "Handling midi OUT transfert");
-    //This is function is called from within usb_host_client_handle_events(). Don't block and try to keep it short
-    //printf("Transfer status %d, actual number of bytes transferred %d\n", transfer->status, transfer->actual_num_bytes);
-    // TODO : notify end of OUT transfert. 
-    actions |= MIDI_CLASS_DRIVER_ACTION_TRANSFER_OUT;
+    out_queue.commit();
+    // wake up the USB task blocked in usb_host_client_handle_events()
+    if ((client_hdl != NULL) && !out_queue.empty()){
+        usb_host_client_unblock(client_hdl);
+    }
 }
 
-void UsbHostMidiClient::action_transfert_out(void)
+// called by the USB task (consumer) : the scan loop events copied to the merge of
+// each of their destination devices
+void UsbHostMidiClient::dispatch_out_events(void)
 {
-    ESP_LOGD(TAG, "Action on midi OUT transfert");
-//    printf("Transfer status %d, actual number of bytes transferred %d\n", out_xfer->status, out_xfer->actual_num_bytes);
+    MidiOutEvent event;
+    while (out_queue.peek(event)){
+        const MidiLane_e lane = midi_lane(event.packet, true);
+        uint32_t targets = event.devices & open_devices.load();
+        if (!out_lanes_ready(targets, lane, event.enqueue_us)){
+            break;  // kept in the queue, dispatched again after the next OUT done
+        }
+        out_queue.pop(event);
+        while (targets){
+            queue_out_event(devices[std::countr_zero(targets)], lane, event);
+            targets &= targets - 1;
+        }
+    }
 }
 
+// room in the lane of every destination device, or the event can be dropped for them : a full
+// lane waits (up to MIDI_OUT_WAIT_US) for the OUT transfers of its device in flight
+bool UsbHostMidiClient::out_lanes_ready(uint32_t targets, MidiLane_e lane, int64_t enqueue_us)
+{
+    const bool in_time = (esp_timer_get_time() - enqueue_us) < MIDI_OUT_WAIT_US;
+    while (targets){
+        MidiDevice& dev = devices[std::countr_zero(targets)];
+        targets &= targets - 1;
+        if ((dev.out_ep_desc == NULL) || !dev.merger.full(lane)){
+            continue;
+        }
+        // events already merged moved to the free transfers first
+        send_pending_events(dev);
+        const std::size_t out_in_flight = dev.xfers.size() - dev.xfers_free_count - dev.in_xfers_armed;
+        if (dev.merger.full(lane) && (out_in_flight > 0) && in_time){
+            return false;
+        }
+    }
+    return true;
+}
 
+void UsbHostMidiClient::queue_out_event(MidiDevice& dev, MidiLane_e lane, const MidiOutEvent& event)
+{
+    // no OUT endpoint : nothing to send to this device
+    if ((dev.out_ep_desc == NULL) || dev.merger.push(lane, event)){
+        return;
+    }
+    // lane full : burst larger than a lane (whole pedalboard glissando), the events already
+    // merged are moved to the free transfers first
+    send_pending_events(dev);
+    if (!dev.merger.push(lane, event)){
+        // this device does not keep up : its event only is dropped
+        event_log(LogEvent_e::MIDI_OUT_DROPPED, event_log_packet(event.packet.data()));
+    }
+}
 
-void UsbHostMidiClient::arm_transfert_in(void)
+// called by the USB task : events of one device sent with its own transfers,
+// in the order given by its merge lanes
+void UsbHostMidiClient::send_pending_events(MidiDevice& dev)
 {
-    ESP_LOGD(TAG, "Arming IN transfert");
-    //memset(in_xfer->data_buffer, 0xAA, USB_EP_DESC_GET_MPS(midi_in_ep_desc));
-    usb_host_transfer_submit(in_xfer);
+    if ((dev.out_ep_desc == NULL) || dev.closing){
+        return;
+    }
+    while (dev.merger.ready(esp_timer_get_time())){
+        MidiTransfer *out = get_transfer(dev);
+        if (out == NULL){
+            break;  // all transfers in flight, sent from the next OUT done
+        }
+        usb_transfer_t *out_xfer = out->xfer;
+        const std::size_t max_bytes = std::min<std::size_t>(USB_EP_DESC_GET_MPS(dev.out_ep_desc), out_xfer->data_buffer_size);
+        out->first_token = 0;
+        out->last_token = 0;
+        out->nb_events = 0;
+        out->submit_us = esp_timer_get_time();
+        // as many event packets as the endpoint max packet size allows
+        out_xfer->num_bytes = dev.merger.pop_transfer({out_xfer->data_buffer, max_bytes}, out_max_events.load(), out->submit_us,
+            [&](const MidiOutEvent& event){
+                out->origin_us[out->nb_events++] = event.origin_us;
+                if (event.token != 0){
+                    latency_record(LatencyStage_e::ENQUEUE_TO_SUBMIT, out->submit_us - event.enqueue_us);
+                    if (out->first_token == 0){
+                        out->first_token = event.token;
+                    }
+                    out->last_token = event.token;
+                }
+                out_event_count++;
+            });
+        submit_midi_transfert_out(out);
+    }
 }
 
-static void usb_client_midi_in_transfer_cb(usb_transfer_t *transfer)
+void UsbHostMidiClient::submit_midi_transfert_out(MidiTransfer *out)
+{
+    usb_transfer_t *out_xfer = out->xfer;
+    out_xfer->bEndpointAddress = out->device->out_ep_desc->bEndpointAddress;
+    out_xfer->callback = usb_client_midi_out_transfer_cb;
+    event_log(LogEvent_e::MIDI_OUT_XFER, out_xfer->num_bytes, event_log_packet(out_xfer->data_buffer));
+    //Send an OUT transfer to EP1
+    if (usb_host_transfer_submit(out_xfer) == ESP_OK){
+        out_transfer_count++;
+    } else {
+        // back to the free list, events reported as not sent
+        out_xfer->status = USB_TRANSFER_STATUS_ERROR;
+        handle_midi_out_transfert(out);
+    }
+}
+
+static void usb_client_midi_out_transfer_cb(usb_transfer_t *transfer)
 {
     //This is function is called from within usb_host_client_handle_events(). Don't block and try to keep it short
-    UsbHostMidiClient *midi_client_p = static_cast<UsbHostMidiClient*>(transfer->context);
-    midi_client_p->handle_midi_in_transfert(transfer);
+    MidiTransfer *out = static_cast<MidiTransfer*>(transfer->context);
+    out->device->client->handle_midi_out_transfert(out);
 }
 
-void UsbHostMidiClient::handle_midi_in_transfert(usb_transfer_t *transfer)
+void UsbHostMidiClient::handle_midi_out_transfert(MidiTransfer *out)
 {
-    ESP_LOGD(TAG, "Handling midi IN transfert");
     //This is function is called from within usb_host_client_handle_events(). Don't block and try to keep it short
-    actions |= MIDI_CLASS_DRIVER_ACTION_TRANSFER_IN;
+    const int64_t done_us = esp_timer_get_time();
+    if (out->xfer->status == USB_TRANSFER_STATUS_COMPLETED){
+        latency_record(LatencyStage_e::SUBMIT_TO_DONE, done_us - out->submit_us);
+        for (std::size_t e = 0; e < out->nb_events; e++){
+            if (out->origin_us[e] != 0){
+                latency_record(LatencyStage_e::PEDAL_TO_WIRE, done_us - out->origin_us[e]);
+            }
+        }
+    }
+    if (out_done_callback != NULL){
+        const MidiOutCompletion completion{
+            .device = out->device->index,
+            .first_token = out->first_token,
+            .last_token = out->last_token,
+            .timestamp_us = done_us,
+            .status = out->xfer->status,
+        };
+        out_done_callback(completion, out_done_callback_arg);
+    }
+    // transfer available again for the next events, or for IN if it ran out of spare transfers
+    MidiDevice& dev = *out->device;
+    put_transfer(out);
+    arm_transfert_in(dev);
+}
+
 
 
-    // get ready for next IN transfert
-    // FIXME : à déplacer APRES le traitement des données reçues
-//    arm_transfert_in();
+// keeps MIDI_IN_XFER_ARMED IN transfers of the device submitted (as long as spare transfers are available)
+void UsbHostMidiClient::arm_transfert_in(MidiDevice& dev)
+{
+    if ((dev.in_ep_desc == NULL) || dev.closing){
+        return;
+    }
+    while (dev.in_xfers_armed < MIDI_IN_XFER_ARMED){
+        MidiTransfer *in = get_transfer(dev);
+        if (in == NULL){
+            ESP_LOGD(TAG, "No spare transfer to arm IN (slot %d)", dev.index);
+            return;
+        }
+        ESP_LOGD(TAG, "Arming IN transfert");
+        in->xfer->num_bytes = USB_EP_DESC_GET_MPS(dev.in_ep_desc);
+        in->xfer->bEndpointAddress = dev.in_ep_desc->bEndpointAddress;
+        in->xfer->callback = usb_client_midi_in_transfer_cb;
+        if (usb_host_transfer_submit(in->xfer) != ESP_OK){
+            put_transfer(in);
+            return;
+        }
+        dev.in_xfers_armed++;
+    }
+}
+
+static void usb_client_midi_in_transfer_cb(usb_transfer_t *transfer)
+{
+    //This is function is called from within usb_host_client_handle_events(). Don't block and try to keep it short
+    MidiTransfer *in = static_cast<MidiTransfer*>(transfer->context);
+    in->device->client->handle_midi_in_transfert(in);
 }
 
-void UsbHostMidiClient::action_transfert_in(void)
+void UsbHostMidiClient::handle_midi_in_transfert(MidiTransfer *in)
 {
-    ESP_LOGD(TAG, "Action on midi IN transfert");
-    printf("MIDI IN : ");
-    for (int i = 0; i < in_xfer->actual_num_bytes; ++i){
-        printf("%02X ", in_xfer->data_buffer[i]);
+    ESP_LOGD(TAG, "Handling midi IN transfert : %d bytes (status %d)", in->xfer->actual_num_bytes, in->xfer->status);
+    //This is function is called from within usb_host_client_handle_events(). Don't block and try to keep it short
+    MidiDevice& dev = *in->device;
+    dev.in_xfers_armed--;
+    const usb_transfer_status_t status = in->xfer->status;
+    if ((status == USB_TRANSFER_STATUS_NO_DEVICE) || (status == USB_TRANSFER_STATUS_CANCELED) || dev.closing){
+        put_transfer(in);
+        return;
     }
-    printf(" (%d bytes) (status %d)\n", in_xfer->actual_num_bytes, in_xfer->status);
-    pass_through();
-    // get ready for next IN transfert
-    // FIXME : à déplacer APRES le traitement des données reçues
-    arm_transfert_in();
+    event_log(LogEvent_e::MIDI_IN_XFER, in->xfer->actual_num_bytes, event_log_packet(in->xfer->data_buffer));
+    const uint8_t thru_devices = dev.thru_devices.load() & open_devices.load();
+    if (pass_through_on && (thru_devices != 0) && (status == USB_TRANSFER_STATUS_COMPLETED) && (pass_through(in) > 0)){
+        // back to the sending device with the received transfer itself when nothing has to be merged
+        // with its packets, the other destinations merge them with their own events
+        const uint8_t self = 1u << dev.index;
+        const bool in_place = (thru_devices & self) && pass_through_in_place(in);
+        pass_through_copy(in, in_place ? (thru_devices & ~self) : thru_devices);
+        if (in_place){
+            pass_through_send(in);
+        } else {
+            put_transfer(in);
+        }
+    } else {
+        put_transfer(in);
+    }
+    // IN endpoint re-armed at once with a spare transfer
+    arm_transfert_in(dev);
 }
 
 
@@ -404,14 +684,105 @@ void UsbHostMidiClient::activate_pass_through(bool pass_on){
     pass_through_on = pass_on;
 }
 
-void UsbHostMidiClient::pass_through(void){
-    if (pass_through_on){
-        // Reeived MIDI IN message copy to Midi OUT
-        for (int i = 0; i < in_xfer->actual_num_bytes; ++i){
-            out_xfer->data_buffer[i] = in_xfer->data_buffer[i];
+void UsbHostMidiClient::set_thru_router(const MidiRouter& router){
+    thru_router = router;
+}
+
+void UsbHostMidiClient::set_thru_devices(std::size_t device, uint8_t devices_mask){
+    devices[device].thru_devices = devices_mask;
+}
+
+// Received MIDI IN event packets routed in place (dropped packets removed), returns the number of bytes left
+std::size_t UsbHostMidiClient::pass_through(MidiTransfer *in){
+    usb_transfer_t *xfer = in->xfer;
+    // whole event packets only
+    const std::size_t nb_received = static_cast<std::size_t>(xfer->actual_num_bytes) & ~std::size_t{3};
+    const MidiRouteResult result = midi_route_packets(thru_router, {xfer->data_buffer, nb_received}, {xfer->data_buffer, nb_received});
+    thru_forwarded_count += result.nb_written / sizeof(MidiEventPacket);
+    thru_dropped_count += result.nb_dropped;
+    xfer->num_bytes = result.nb_written;
+    return result.nb_written;
+}
+
+// Routed packets can be sent back to their own device in the received transfer (no copy) :
+// no pedal event or SysEx message of the device waiting, and no SysEx packet received.
+// Otherwise the merge lanes are needed
+bool UsbHostMidiClient::pass_through_in_place(const MidiTransfer *in) const {
+    const MidiDevice& dev = *in->device;
+    if ((dev.out_ep_desc == NULL) || !dev.merger.idle()){
+        return false;
+    }
+    const MidiPacketReader packets{{in->xfer->data_buffer, static_cast<std::size_t>(in->xfer->num_bytes)}};
+    for (std::size_t p = 0; p < packets.size(); p++){
+        if (midi_lane(packets[p], false) == MidiLane_e::SYSEX){
+            return false;
+        }
+    }
+    return true;
+}
+
+// received transfer resubmitted on the OUT endpoint of its device (pass through only : no
+// completion report, not counted in the merge lanes statistics)
+void UsbHostMidiClient::pass_through_send(MidiTransfer *in){
+    in->first_token = 0;
+    in->last_token = 0;
+    in->nb_events = 0;
+    in->submit_us = esp_timer_get_time();
+    out_event_count += in->xfer->num_bytes / sizeof(MidiEventPacket);
+    submit_midi_transfert_out(in);
+}
+
+// Routed packets of a received transfer queued in the merge lanes of the destination
+// devices (token 0 : no completion report)
+void UsbHostMidiClient::pass_through_copy(const MidiTransfer *in, uint8_t devices_mask){
+    const int64_t now_us = esp_timer_get_time();
+    const MidiPacketReader packets{{in->xfer->data_buffer, static_cast<std::size_t>(in->xfer->num_bytes)}};
+    for (std::size_t p = 0; p < packets.size(); p++){
+        const MidiOutEvent event{packets[p], 0, 0, now_us, devices_mask};
+        const MidiLane_e lane = midi_lane(event.packet, false);
+        uint32_t targets = devices_mask;
+        while (targets){
+            queue_out_event(devices[std::countr_zero(targets)], lane, event);
+            targets &= targets - 1;
         }
-        out_xfer->num_bytes = in_xfer->actual_num_bytes;
-        // send message
-        submit_midi_transfert_out();
+    }
+}
+
+static const char *const midi_lane_names[] = {
+    "realtime",
+    "pedal",
+    "thru voice",
+    "sysex",
+};
+
+// merge lanes statistics of the open devices
+void UsbHostMidiClient::log_stats(void) const
+{
+    for (const MidiDevice& dev : devices){
+        if (!device_connected(dev.index)){
+            continue;
+        }
+        for (std::size_t l = 0; l < std::to_underlying(MidiLane_e::NB_LANES); l++){
+            const MidiLaneStats stats = dev.merger.stats(static_cast<MidiLane_e>(l));
+            if ((stats.nb_packets == 0) && (stats.nb_drops == 0)){
+                continue;
+            }
+            ESP_LOGI(TAG, "device %u %-10s : %lu packets, delay mean %lu / max %lu us, %lu dropped", dev.index, midi_lane_names[l],
+                static_cast<unsigned long>(stats.nb_packets),
+                static_cast<unsigned long>(stats.mean_delay_us),
+                static_cast<unsigned long>(stats.max_delay_us),
+                static_cast<unsigned long>(stats.nb_drops));
+        }
+        if (dev.merger.sysex_timeouts() > 0){
+            ESP_LOGI(TAG, "device %u : %lu unfinished SysEx message(s) ended", dev.index,
+                static_cast<unsigned long>(dev.merger.sysex_timeouts()));
+        }
+    }
+}
+
+void UsbHostMidiClient::reset_stats(void)
+{
+    for (MidiDevice& dev : devices){
+        dev.merger.reset_stats();
     }
 }
@@ -1,26 +1,144 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <span>
+
 #include "esp_log.h"
 #include "freertos/task.h"
 #include "usb/usb_host.h"  // USB Host library
 
+#include "spsc_queue.hpp"
+#include "midi_packet.hpp"
+#include "midi_router.hpp"
+#include "midi_merger.hpp"
+#include "task_config.hpp"
+
+// MIDI OUT events waiting to be sent (pushed by the scan loop, drained by the USB task)
+#define MIDI_OUT_QUEUE_SIZE 64
+// USB transfers of a device, shared by MIDI IN and OUT
+#define MIDI_XFER_POOL_SIZE 6
+// IN transfers kept armed (the IN endpoint is never idle)
+#define MIDI_IN_XFER_ARMED 2
+// event packets in one OUT transfer (64 bytes full speed bulk max packet size)
+#define MIDI_OUT_XFER_MAX_EVENTS 16
+// MIDI devices opened at once (several devices behind a hub)
+#define MIDI_MAX_DEVICES 4
+// destination devices mask : bit d for the device of slot d
+#define MIDI_ALL_DEVICES 0xFF
+// events waiting for an OUT transfer of one device, per merge lane : a slow device only
+// drops its own events
+#define MIDI_MERGE_LANE_SIZE 32
+// max wait of a scan loop event in the OUT queue while a merge lane of its destination is full
+// and OUT transfers of that device are in flight, then the event is dropped for that device
+#define MIDI_OUT_WAIT_US 20000
+// max wait of the packets held inside an unfinished SysEx message (pass through), then the
+// message is ended
+#define MIDI_SYSEX_HOLD_US 50000
+
+// completion of one OUT transfer : events [first_token, last_token] (0, 0 : pass through only).
+// An event sent to several devices is reported once per device
+struct MidiOutCompletion{
+    uint8_t device;
+    uint32_t first_token;
+    uint32_t last_token;
+    int64_t timestamp_us;   // esp_timer time of the completion
+    usb_transfer_status_t status;
+};
+
+// called from the USB task, keep it short
+using MidiOutDoneCallback = void (*)(const MidiOutCompletion& completion, void *arg);
+
+class UsbHostMidiClient;
+struct MidiDevice;
+
+// one transfer of a device pool and the queued events it carries (OUT)
+struct MidiTransfer{
+    MidiDevice *device;
+    usb_transfer_t *xfer;
+    uint32_t first_token;
+    uint32_t last_token;
+    int64_t submit_us;
+    std::size_t nb_events;
+    std::array<int64_t, MIDI_OUT_XFER_MAX_EVENTS> origin_us;
+};
+
+// one opened MIDI device, with its own transfers : a slow device does not stall the others
+struct MidiDevice{
+    UsbHostMidiClient *client;
+    uint8_t index;      // slot in the devices table (bit of the destination masks)
+    uint8_t dev_addr;   // 0 : free slot
+    usb_device_handle_t dev_hdl;
+    bool open_pending;
+    bool close_pending;
+    bool closing;       // endpoints halted, waiting for the in flight transfers before the release
+
+    const usb_intf_desc_t *intf_desc;
+    const usb_ep_desc_t *in_ep_desc;
+    const usb_ep_desc_t *out_ep_desc;
+
+    // transfers pool, free list and OUT events merge only used by the USB task
+    std::array<MidiTransfer, MIDI_XFER_POOL_SIZE> xfers;
+    std::array<MidiTransfer*, MIDI_XFER_POOL_SIZE> xfers_free;
+    std::size_t xfers_free_count;
+    std::size_t in_xfers_armed;
+    MidiMerger<MIDI_MERGE_LANE_SIZE, 4, MIDI_SYSEX_HOLD_US> merger;  // pedal events and pass through packets for this device
+
+    std::atomic<uint8_t> thru_devices;  // destinations of the packets received from this device
+};
+
 class UsbHostMidiClient{
 
 public:
 
-    UsbHostMidiClient();
+    explicit UsbHostMidiClient(const TaskConfig& task_config);
     ~UsbHostMidiClient();
 
-    void install(void);
+    void install(const TaskConfig& task_config);
+    // at least one MIDI device opened
     bool connected(void);
+    bool device_connected(std::size_t device) const {return (open_devices.load() >> device) & 1;}
+    std::size_t nb_devices(void) const;
 
-    void arm_transfert_in(void);
-
-    void send_note(bool note_on, uint8_t note);
+    // origin_us : pedal state read time, for the latency measurements (0 : now)
+    void send_note(bool note_on, uint8_t note, int64_t origin_us = 0);
+    // pre-encoded event packets (pedal MIDI map), sent to the devices of the mask
+    void send_events(std::span<const MidiEventPacket> packets, int64_t origin_us = 0, uint8_t devices = MIDI_ALL_DEVICES);
     void send_local_control(bool local_ctrl_on);
 
     void activate_pass_through(bool pass_on);
-    void pass_through(void);
+    // MIDI IN -> OUT routing (filtering, channel / cable remapping), set before enabling pass through
+    void set_thru_router(const MidiRouter& router);
+    // devices receiving the MIDI IN of a device (default : the device itself)
+    void set_thru_devices(std::size_t device, uint8_t devices);
+    // pass through packets forwarded / dropped (router or OUT transfer full)
+    uint32_t thru_forwarded(void) const {return thru_forwarded_count;}
+    uint32_t thru_dropped(void) const {return thru_dropped_count;}
+
+    // queue one event (scan loop), returns its token (0 if the queue is full).
+    // Completion reported to the OUT done callback
+    uint32_t send_async(const MidiEventPacket& packet, int64_t origin_us = 0, uint8_t devices = MIDI_ALL_DEVICES);
+    void set_out_done_callback(MidiOutDoneCallback callback, void *arg);
+
+    // hand the events of the current scan over to the USB task
+    void flush(void);
+
+    // MIDI OUT queue statistics
+    std::size_t out_queue_depth(void) const {return out_queue.size();}
+    std::size_t out_queue_high_water(void) const {return out_queue.high_water();}
+    uint32_t out_queue_drops(void) const {return out_queue.drops();}
+    // OUT transfers submitted / event packets sent in them (batching efficiency)
+    uint32_t out_transfers(void) const {return out_transfer_count;}
+    uint32_t out_events(void) const {return out_event_count;}
+    // event packets per OUT transfer (1 : no batching, benchmarks), MIDI_OUT_XFER_MAX_EVENTS by default
+    void set_out_batch_limit(std::size_t max_events) {out_max_events = std::clamp<std::size_t>(max_events, 1, MIDI_OUT_XFER_MAX_EVENTS);}
+    // events dropped for one device (its merge lanes full)
+    uint32_t out_device_drops(std::size_t device) const {return devices[device].merger.drops();}
+    // merge lanes queueing delay of one device
+    MidiLaneStats lane_stats(std::size_t device, MidiLane_e lane) const {return devices[device].merger.stats(lane);}
+    void log_stats(void) const;
+    void reset_stats(void);
 
     // called by task function
     void register_(void);
@@ -29,29 +147,50 @@ public:
     // called by event_cb given to usb host lib
     void handle_event(const usb_host_client_event_msg_t *event_msg);
     // called by transfert_cb given to usb host lib
-    void handle_midi_in_transfert(usb_transfer_t *transfer);
-    void handle_midi_out_transfert(usb_transfer_t *transfer);
+    void handle_midi_in_transfert(MidiTransfer *in);
+    void handle_midi_out_transfert(MidiTransfer *out);
 
 private:
     TaskHandle_t task_hdl;
-    uint8_t actions;
-    uint8_t dev_addr;
+    std::atomic<uint8_t> actions;  // MIDI_CLASS_DRIVER_ACTION_* posted for the USB task
     usb_host_client_handle_t client_hdl;
-    usb_device_handle_t dev_hdl;
 
-    const usb_intf_desc_t *midi_intf_desc;
-    const usb_ep_desc_t *midi_in_ep_desc;
-    const usb_ep_desc_t *midi_out_ep_desc;
-    
-    usb_transfer_t *in_xfer;
-    usb_transfer_t *out_xfer;
+    std::array<MidiDevice, MIDI_MAX_DEVICES> devices;
+    std::atomic<uint8_t> open_devices;  // devices with a MIDI interface claimed
 
     bool pass_through_on;
+    MidiRouter thru_router;
+    std::atomic<uint32_t> thru_forwarded_count;
+    std::atomic<uint32_t> thru_dropped_count;
+
+    SpscQueue<MidiOutEvent, MIDI_OUT_QUEUE_SIZE> out_queue;
+    uint32_t out_next_token;  // producer side
+    MidiOutDoneCallback out_done_callback;
+    void *out_done_callback_arg;
+    std::atomic<uint32_t> out_transfer_count;
+    std::atomic<uint32_t> out_event_count;
+    std::atomic<std::size_t> out_max_events;
+
+    void dispatch_out_events(void);
+    bool out_lanes_ready(uint32_t targets, MidiLane_e lane, int64_t enqueue_us);
+    void queue_out_event(MidiDevice& dev, MidiLane_e lane, const MidiOutEvent& event);
+    void send_pending_events(MidiDevice& dev);
+    void submit_midi_transfert_out(MidiTransfer *out);
+    std::size_t pass_through(MidiTransfer *in);
+    bool pass_through_in_place(const MidiTransfer *in) const;
+    void pass_through_send(MidiTransfer *in);
+    void pass_through_copy(const MidiTransfer *in, uint8_t devices);
 
-    void submit_midi_transfert_out(void);
+    void arm_transfert_in(MidiDevice& dev);
+    void alloc_transfers(MidiDevice& dev);
+    void free_transfers(MidiDevice& dev);
+    MidiTransfer *get_transfer(MidiDevice& dev);
+    void put_transfer(MidiTransfer *xfer);
 
+    void post_action(uint8_t action, uint8_t cancel = 0);
     void action_open_dev(void);
     void action_close_dev(void);
-    void action_transfert_out(void);
-    void action_transfert_in(void);
+    void open_device(MidiDevice& dev);
+    void close_device(MidiDevice& dev);
+    void halt_endpoint(MidiDevice& dev, const usb_ep_desc_t *ep_desc);
 };